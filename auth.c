@@ -20,8 +20,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
-#define BASE64_LENGTH(src_len) (4 * (((src_len) + 2) / 3))
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include "common.h"
 #include "auth.h"
@@ -37,10 +38,13 @@ static char *auth_basic_hash = NULL;
 
 static const char *_MODE_STR[] = {"off", "basic"};
 
-
-    /* local functions */
-
-static void base64_encode(const char *src, char *dest, int len);
+/* clients presenting one of the priority credentials, or connecting to one of the priority (listen)
+ * addresses, get the high priority class; everybody else gets the low one */
+static char **priority_hashes = NULL;
+static int num_priority_hashes = 0;
+static struct in_addr *priority_addrs = NULL;
+static in_addr_t *priority_masks = NULL;
+static int num_priority_addrs = 0;
 
 
 void set_auth(int mode, char *username, char *password, char *realm) {
@@ -78,6 +82,89 @@ char *get_auth_basic_hash() {
     return auth_basic_hash;
 }
 
+int auth_basic_valid(char *hash) {
+    int i;
+
+    if (!hash) {
+        return 0;
+    }
+
+    /* priority credentials are good for authentication as well */
+    for (i = 0; i < num_priority_hashes; i++) {
+        if (!strcmp(hash, priority_hashes[i])) {
+            return 1;
+        }
+    }
+
+    return auth_username && !strcmp(hash, get_auth_basic_hash());
+}
+
+int add_priority_rule(char *rule) {
+    char addr[INET_ADDRSTRLEN];
+    char *hash, *slash, *end;
+    int bits = 32;
+
+    if (strchr(rule, ':')) { /* user:pass */
+        hash = malloc(BASE64_LENGTH(strlen(rule)) + 1);
+        base64_encode(rule, hash, strlen(rule));
+
+        priority_hashes = realloc(priority_hashes, sizeof(char *) * (num_priority_hashes + 1));
+        priority_hashes[num_priority_hashes++] = hash;
+
+        DEBUG("added priority credentials");
+
+        return 0;
+    }
+
+    /* address[/bits] */
+    slash = strchr(rule, '/');
+    if (slash) {
+        bits = strtol(slash + 1, &end, 10);
+        if (*end || end == slash + 1 || bits < 0 || bits > 32) {
+            return -1;
+        }
+    }
+
+    snprintf(addr, sizeof(addr), "%.*s", slash ? (int) (slash - rule) : (int) strlen(rule), rule);
+
+    priority_addrs = realloc(priority_addrs, sizeof(struct in_addr) * (num_priority_addrs + 1));
+    priority_masks = realloc(priority_masks, sizeof(in_addr_t) * (num_priority_addrs + 1));
+    if (inet_pton(AF_INET, addr, &priority_addrs[num_priority_addrs]) != 1) {
+        return -1;
+    }
+    priority_masks[num_priority_addrs] = bits ? htonl(0xFFFFFFFF << (32 - bits)) : 0;
+    num_priority_addrs++;
+
+    DEBUG("added priority address %s/%d", addr, bits);
+
+    return 0;
+}
+
+int auth_priority(char *hash, int fd) {
+    struct sockaddr_in local_addr;
+    socklen_t len = sizeof(local_addr);
+    int i;
+
+    for (i = 0; hash && i < num_priority_hashes; i++) {
+        if (!strcmp(hash, priority_hashes[i])) {
+            return PRIORITY_HIGH;
+        }
+    }
+
+    /* the address the client connected to, telling apart the interfaces we listen on */
+    if (num_priority_addrs && !getsockname(fd, (struct sockaddr *) &local_addr, &len) &&
+            local_addr.sin_family == AF_INET) {
+
+        for (i = 0; i < num_priority_addrs; i++) {
+            if (!((local_addr.sin_addr.s_addr ^ priority_addrs[i].s_addr) & priority_masks[i])) {
+                return PRIORITY_HIGH;
+            }
+        }
+    }
+
+    return PRIORITY_LOW;
+}
+
 
 void base64_encode(const char *src, char *dest, int len) {
     static const char conv_table[64] = {
@@ -92,15 +179,20 @@ void base64_encode(const char *src, char *dest, int len) {
     };
 
     int i;
-    unsigned char * p = (unsigned char *) dest;
+    unsigned char *p = (unsigned char *) dest;
+    const unsigned char *s = (const unsigned char *) src;
+    unsigned char s1, s2;
 
-    /* transform 3x8 -> 4x6 bits */
+    /* transform 3x8 -> 4x6 bits; src may be binary data (e.g. a digest),
+     * so never read past its end */
     for (i = 0; i < len; i += 3) {
-        *p++ = conv_table[src[0] >> 2];
-        *p++ = conv_table[((src[0] & 3) << 4) + (src[1] >> 4)];
-        *p++ = conv_table[((src[1] & 0xf) << 2) + (src[2] >> 6)];
-        *p++ = conv_table[src[2] & 0x3f];
-        src += 3;
+        s1 = i + 1 < len ? s[1] : 0;
+        s2 = i + 2 < len ? s[2] : 0;
+        *p++ = conv_table[s[0] >> 2];
+        *p++ = conv_table[((s[0] & 3) << 4) + (s1 >> 4)];
+        *p++ = conv_table[((s1 & 0xf) << 2) + (s2 >> 6)];
+        *p++ = conv_table[s2 & 0x3f];
+        s += 3;
     }
 
     /* padding */
@@ -23,10 +23,19 @@
 #define AUTH_OFF    0
 #define AUTH_BASIC  1
 
+#define PRIORITY_LOW    0
+#define PRIORITY_HIGH   1
+
+#define BASE64_LENGTH(src_len) (4 * (((src_len) + 2) / 3))
+
 
 void                set_auth(int mode, char *username, char *password, char *realm);
 int                 get_auth_mode();
 char *              get_auth_realm();
 char *              get_auth_basic_hash();
+int                 auth_basic_valid(char *hash);
+int                 add_priority_rule(char *rule);
+int                 auth_priority(char *hash, int fd);
+void                base64_encode(const char *src, char *dest, int len);
 
 #endif /* __AUTH_H */
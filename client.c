@@ -27,12 +27,25 @@
 #include <time.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 
 #include "streameye.h"
 #include "common.h"
 #include "auth.h"
+#include "websocket.h"
+#include "handoff.h"
+#include "metrics.h"
+#include "latency.h"
+#include "uring.h"
+#include "timelapse.h"
+#include "egress.h"
+#include "crop.h"
+#include "realtime.h"
+#include "motion.h"
+#include "http2.h"
+#include "load.h"
 
 
 const char *RESPONSE_BASIC_AUTH_HEADER_TEMPLATE =
@@ -41,6 +54,13 @@ const char *RESPONSE_BASIC_AUTH_HEADER_TEMPLATE =
         "Connection: close\r\n"
         "WWW-Authenticate: Basic realm=\"%s\"\r\n";
 
+const char *RESPONSE_OVERLOADED_HEADER_TEMPLATE =
+        "HTTP/1.1 503 Service Unavailable\r\n"
+        "Server: streamEye/%s\r\n"
+        "Connection: close\r\n"
+        "Retry-After: %d\r\n"
+        "\r\n";
+
 const char *RESPONSE_OK_HEADER_TEMPLATE =
         "HTTP/1.1 200 OK\r\n"
         "Server: streamEye/%s\r\n"
@@ -51,28 +71,56 @@ const char *RESPONSE_OK_HEADER_TEMPLATE =
         "Pragma: no-cache\r\n"
         "Content-Type: multipart/x-mixed-replace; boundary=" BOUNDARY_SEPARATOR "\r\n";
 
-const char *MULTIPART_HEADER =
+
+const char *RESPONSE_LENGTH_FRAMING_HEADER_TEMPLATE =
+        "HTTP/1.1 200 OK\r\n"
+        "Server: streamEye/%s\r\n"
+        "Connection: close\r\n"
+        "Max-Age: 0\r\n"
+        "Expires: 0\r\n"
+        "Cache-Control: no-cache, private\r\n"
+        "Pragma: no-cache\r\n"
+        "Content-Type: application/octet-stream\r\n"
+        "\r\n";
+
+const char *MULTIPART_HEADER_TEMPLATE =
+        "\r\n" BOUNDARY_SEPARATOR "\r\n"
+        "Content-Type: image/jpeg\r\n"
+        "Content-Length: %d\r\n"
+        "\r\n";
+
+const char *MULTIPART_MOTION_HEADER_TEMPLATE =
         "\r\n" BOUNDARY_SEPARATOR "\r\n"
         "Content-Type: image/jpeg\r\n"
-        "Content-Length: ";
+        "Content-Length: %d\r\n"
+        "X-Motion: %.1f\r\n"
+        "\r\n";
 
 
 static int          read_request(client_t *client);
-static int          write_to_client(client_t *client, char *buf, int size);
+static int          get_uri_param(client_t *client, char *name, char *value, int len);
+static void         init_crop(client_t *client);
+static void         init_motion(client_t *client);
+static void         init_batch(client_t *client);
+static void         update_delivery_stats(client_t *client);
+static void         stream_to_client(client_t *client);
 static int          write_response_ok_header(client_t *client);
 static int          write_response_auth_basic_header(client_t *client);
+static int          write_response_overloaded_header(client_t *client);
 static int          write_multipart_header(client_t *client, int jpeg_size);
+static int          format_length_header(char *buf, int jpeg_size, unsigned int seq, double timestamp);
+static int          writev_to_client(client_t *client, struct iovec *iov, int count, int size);
+static void         queue_batch_frame(client_t *client, double now);
+static int          wait_batch_deadline(client_t *client);
+static int          send_frames(client_t *client);
 
 
     /* client handling */
 
 int read_request(client_t *client) {
     char buf[REQ_BUF_LEN];
-    char *line_end, *header_mid;
-    char *header_name, *header_value;
-    char *auth_mode, *auth_basic_hash;
-    char *strtok_ptr;
-    int size, found, offs = 0;
+    char *line_end;
+    int size, offs = 0;
 
     memset(buf, 0, REQ_BUF_LEN);
 
@@ -113,8 +161,23 @@ int read_request(client_t *client) {
 
     DEBUG_CLIENT(client, "received request header");
 
-    offs = 0;
-    while (running && (line_end = strstr(buf + offs, "\r\n"))) {
+    if (parse_request(client, buf) < 0) {
+        return -1;
+    }
+
+    DEBUG_CLIENT(client, "request read");
+
+    return 0;
+}
+
+int parse_request(client_t *client, char *buf) {
+    char *line_end, *header_mid;
+    char *header_name, *header_value;
+    char *auth_mode, *auth_basic_hash;
+    char *strtok_ptr;
+    int found, offs = 0;
+
+    while ((line_end = strstr(buf + offs, "\r\n"))) {
         if (offs == 0) { /* first request line */
             found = sscanf(buf, "%9s %1023s %9s", client->method, client->uri, client->http_ver);
             if (found != 3) {
@@ -150,6 +213,23 @@ int read_request(client_t *client) {
                         ERROR_CLIENT(client, "unknown authorization header: %s", auth_mode);
                     }
                 }
+                else if (!strcasecmp(header_name, "Upgrade")) {
+                    DEBUG_CLIENT(client, "header: %s: %s", header_name, header_value);
+                    if (!strcasecmp(header_value, "websocket")) {
+                        client->websocket = 1;
+                    }
+                    else if (!strcasecmp(header_value, "h2c")) {
+                        client->http2 = HTTP2_UPGRADE;
+                    }
+                }
+                else if (!strcasecmp(header_name, "HTTP2-Settings")) {
+                    DEBUG_CLIENT(client, "header: %s: %s", header_name, header_value);
+                    snprintf(client->http2_settings, sizeof(client->http2_settings), "%s", header_value);
+                }
+                else if (!strcasecmp(header_name, "Sec-WebSocket-Key")) {
+                    DEBUG_CLIENT(client, "header: %s: %s", header_name, header_value);
+                    snprintf(client->ws_key, sizeof(client->ws_key), "%s", header_value);
+                }
                 else {
                     DEBUG_CLIENT(client, "header: %s: %s", header_name, header_value);
                 }
@@ -162,11 +242,128 @@ int read_request(client_t *client) {
         offs = line_end - buf + 2;
     }
 
-    DEBUG_CLIENT(client, "request read");
+    if (client->websocket && !client->ws_key[0]) {
+        ERROR_CLIENT(client, "missing websocket key");
+        return -1;
+    }
+
+    return 0;
+}
+
+int find_uri_param(const char *uri, char *name, char *value, int len) {
+    const char *p = strchr(uri, '?');
+    int name_len = strlen(name);
+    int value_len;
+
+    while (p) {
+        p++; /* skip "?" or "&" */
+        if (!strncmp(p, name, name_len) && p[name_len] == '=') {
+            p += name_len + 1;
+            value_len = strcspn(p, "&");
+            snprintf(value, len, "%.*s", value_len, p);
+
+            return 1;
+        }
+
+        p = strchr(p, '&');
+    }
 
     return 0;
 }
 
+int get_uri_param(client_t *client, char *name, char *value, int len) {
+    return find_uri_param(client->uri, name, value, len);
+}
+
+void init_crop(client_t *client) {
+    char param[64];
+
+    if (!get_uri_param(client, "crop", param, sizeof(param))) {
+        return;
+    }
+
+    client->crop = crop_acquire(param);
+    if (client->crop) {
+        DEBUG_CLIENT(client, "cropping to %dx%d at %d,%d",
+                client->crop->w, client->crop->h, client->crop->x, client->crop->y);
+    }
+    else {
+        ERROR_CLIENT(client, "invalid crop \"%s\"", param);
+    }
+}
+
+void init_motion(client_t *client) {
+    char param[32];
+    char *end;
+
+    if (!get_uri_param(client, "motion", param, sizeof(param))) {
+        return;
+    }
+
+    if (!motion_enabled()) {
+        ERROR_CLIENT(client, "motion analysis is not enabled, ignoring motion threshold");
+        return;
+    }
+
+    client->motion_threshold = strtod(param, &end);
+    if (*end || client->motion_threshold < 0) {
+        ERROR_CLIENT(client, "invalid motion threshold \"%s\"", param);
+        client->motion_threshold = 0;
+        return;
+    }
+
+    DEBUG_CLIENT(client, "sending frames only while the motion score is at least %.1f", client->motion_threshold);
+}
+
+void init_batch(client_t *client) {
+    char param[32];
+    char *end;
+    long value;
+
+    if (client->websocket) {
+        return; /* websocket messages carry a frame each */
+    }
+
+    if (get_uri_param(client, "framing", param, sizeof(param))) {
+        if (!strcmp(param, "length")) {
+            DEBUG_CLIENT(client, "length-prefixed framing");
+            client->framing = FRAMING_LENGTH;
+        }
+        else if (strcmp(param, "multipart")) {
+            ERROR_CLIENT(client, "invalid framing \"%s\"", param);
+        }
+    }
+
+    if (get_uri_param(client, "batch", param, sizeof(param))) {
+        value = strtol(param, &end, 10);
+        if (*end || value < 1) {
+            ERROR_CLIENT(client, "invalid batch \"%s\"", param);
+        }
+        else {
+            client->batch_max = MIN(value, BATCH_MAX_FRAMES);
+        }
+    }
+
+    if (get_uri_param(client, "batch_ms", param, sizeof(param))) {
+        value = strtol(param, &end, 10);
+        if (*end || value < 1) {
+            ERROR_CLIENT(client, "invalid batch_ms \"%s\"", param);
+        }
+        else {
+            client->batch_int = value / 1000.0;
+            if (!client->batch_max) {
+                client->batch_max = BATCH_MAX_FRAMES;
+            }
+        }
+    }
+
+    if (client->batch_max) {
+        DEBUG_CLIENT(client, "sending frames in batches of up to %d, waiting at most %.0lf ms",
+                client->batch_max, client->batch_int * 1000);
+        client->batch = calloc(client->batch_max, sizeof(batch_frame_t));
+    }
+}
+
 int write_to_client(client_t *client, char *buf, int size) {
     int written = write(client->stream_fd, buf, size);
 
@@ -187,9 +384,31 @@ int write_to_client(client_t *client, char *buf, int size) {
     return written;
 }
 
+int writev_to_client(client_t *client, struct iovec *iov, int count, int size) {
+    int written = writev(client->stream_fd, iov, count);
+
+    if (written < 0) {
+        if (errno == EPIPE || errno == EINTR) {
+            return 0;
+        }
+        else {
+            ERRNO_CLIENT(client, "writev() failed");
+            return -1;
+        }
+    }
+    else if (written < size) {
+        ERROR_CLIENT(client, "not all data could be written");
+        return -1;
+    }
+
+    return written;
+}
+
 int write_response_ok_header(client_t *client) {
-    char *data = malloc(strlen(RESPONSE_OK_HEADER_TEMPLATE) + 16);
-    sprintf(data, RESPONSE_OK_HEADER_TEMPLATE, STREAM_EYE_VERSION);
+    const char *template = client->framing == FRAMING_LENGTH ?
+            RESPONSE_LENGTH_FRAMING_HEADER_TEMPLATE : RESPONSE_OK_HEADER_TEMPLATE;
+    char *data = malloc(strlen(template) + 16);
+    sprintf(data, template, STREAM_EYE_VERSION);
 
     int r = write_to_client(client, data, strlen(data));
     free(data);
@@ -208,24 +427,64 @@ int write_response_auth_basic_header(client_t *client) {
     return r;
 }
 
-int write_multipart_header(client_t *client, int jpeg_size) {
-    static int multipart_header_len = 0;
-    if (!multipart_header_len) {
-        multipart_header_len = strlen(MULTIPART_HEADER);
+int write_response_overloaded_header(client_t *client) {
+    char header[256];
+
+    /* by then, the load level has had time to step down */
+    snprintf(header, sizeof(header), RESPONSE_OVERLOADED_HEADER_TEMPLATE, STREAM_EYE_VERSION,
+            LOAD_STEP_INTERVAL * (LOAD_LEVEL_SHED + 1));
+
+    return write_to_client(client, header, strlen(header));
+}
+
+int format_multipart_header(char *buf, int len, int jpeg_size, double motion) {
+    /* the motion score is that of the frame itself, and left out for frames that weren't analyzed */
+    if (motion >= 0) {
+        return MIN(snprintf(buf, len, MULTIPART_MOTION_HEADER_TEMPLATE, jpeg_size, motion), len - 1);
     }
 
-    int written = write_to_client(client, (char *) MULTIPART_HEADER, multipart_header_len);
-    if (written <= 0) {
-        return written;
+    return MIN(snprintf(buf, len, MULTIPART_HEADER_TEMPLATE, jpeg_size), len - 1);
+}
+
+int write_multipart_header(client_t *client, int jpeg_size) {
+    char header[MULTIPART_HEADER_LEN];
+    int len;
+
+    if (client->framing == FRAMING_LENGTH) {
+        len = format_length_header(header, jpeg_size, client->jpeg_tmp_seq, client->jpeg_tmp_timestamp);
     }
+    else {
+        len = format_multipart_header(header, sizeof(header), jpeg_size, client->jpeg_tmp_motion);
+    }
+
+    return write_to_client(client, header, len);
+}
 
-    char size_str[16];
-    snprintf(size_str, 16, "%d\r\n\r\n", jpeg_size);
+int format_length_header(char *buf, int jpeg_size, unsigned int seq, double timestamp) {
+    uint64_t ms = timestamp * 1000;
+    int i;
 
-    return write_to_client(client, size_str, strlen(size_str));
+    /* all big endian: the length of the frame, its sequence number and its timestamp in milliseconds */
+    for (i = 0; i < 4; i++) {
+        buf[i] = (unsigned int) jpeg_size >> (24 - 8 * i);
+        buf[4 + i] = seq >> (24 - 8 * i);
+    }
+    for (i = 0; i < 8; i++) {
+        buf[8 + i] = ms >> (56 - 8 * i);
+    }
+
+    return LENGTH_HEADER_LEN;
 }
 
 void handle_client(client_t *client) {
+    realtime_thread(REALTIME_CLIENTS);
+
+    if (http2_detect(client)) {
+        http2_serve(client);
+
+        return;
+    }
+
     DEBUG_CLIENT(client, "reading client request");
     int result = read_request(client);
     if (result < 0) {
@@ -236,7 +495,7 @@ void handle_client(client_t *client) {
     }
 
     if (get_auth_mode() == AUTH_BASIC) {
-        if (!client->auth_basic_hash || strcmp(client->auth_basic_hash, get_auth_basic_hash())) {
+        if (!auth_basic_valid(client->auth_basic_hash)) {
             if (client->auth_basic_hash) {
                 ERROR_CLIENT(client, "authentication error");
             }
@@ -257,8 +516,49 @@ void handle_client(client_t *client) {
         }
     }
 
+    if (client->http2) {
+        /* the request becomes the first stream of the connection */
+        http2_serve(client);
+
+        return;
+    }
+
+    if (is_metrics_request(client)) {
+        DEBUG_CLIENT(client, "writing metrics");
+        if (metrics_write(client) < 0) {
+            ERROR_CLIENT(client, "failed to write metrics");
+        }
+
+        cleanup_client(client);
+
+        return;
+    }
+
+    client->priority = auth_priority(client->auth_basic_hash, client->stream_fd);
+    if (client->priority < PRIORITY_HIGH && load_shedding()) {
+        INFO_CLIENT(client, "overloaded, turning away low priority client");
+        result = write_response_overloaded_header(client);
+        if (result < 0) {
+            ERROR_CLIENT(client, "failed to write response header");
+        }
+
+        cleanup_client(client);
+
+        return;
+    }
+    else if (client->priority == PRIORITY_HIGH) {
+        DEBUG_CLIENT(client, "high priority client");
+    }
+
+    init_batch(client);
+
     DEBUG_CLIENT(client, "writing response header");
-    result = write_response_ok_header(client);
+    if (client->websocket) {
+        result = websocket_write_handshake(client);
+    }
+    else {
+        result = write_response_ok_header(client);
+    }
     if (result < 0) {
         ERROR_CLIENT(client, "failed to write response header");
         cleanup_client(client);
@@ -266,7 +566,84 @@ void handle_client(client_t *client) {
         return;
     }
 
+    char param[32];
+    double rate = get_client_rate_limit(), requested_rate;
+    if (get_uri_param(client, "rate", param, sizeof(param))) {
+        requested_rate = parse_rate(param);
+        if (requested_rate < 0) {
+            ERROR_CLIENT(client, "invalid rate \"%s\"", param);
+        }
+        else if (rate && (!requested_rate || requested_rate > rate)) {
+            /* clients may lower the configured limit, but not lift it (0 meaning unlimited) */
+            DEBUG_CLIENT(client, "rate \"%s\" above the per-client limit, ignored", param);
+        }
+        else {
+            rate = requested_rate;
+        }
+    }
+
+    if (rate) {
+        DEBUG_CLIENT(client, "limiting rate to %.0lf B/s", rate);
+    }
+    rate_limiter_init(&client->rate_limiter, rate);
+
+    client->live = get_live_mode();
+    if (get_uri_param(client, "live", param, sizeof(param))) {
+        client->live = strcmp(param, "0") && strcmp(param, "false");
+    }
+    if (client->live) {
+        DEBUG_CLIENT(client, "live mode enabled");
+        if (latency_enable(client) < 0) {
+            client->live = 0;
+        }
+    }
+
+    init_crop(client);
+    init_motion(client);
+
+    if (get_uri_param(client, "interval", param, sizeof(param))) {
+        client->interval = parse_interval(param);
+        if (client->interval < 0) {
+            ERROR_CLIENT(client, "invalid interval \"%s\"", param);
+            client->interval = 0;
+        }
+    }
+
+    stream_to_client(client);
+}
+
+void resume_client(client_t *client) {
+    realtime_thread(REALTIME_CLIENTS);
+    DEBUG_CLIENT(client, "resuming stream");
+
+    rate_limiter_init(&client->rate_limiter, client->rate_limiter.rate);
+    init_crop(client);
+    init_motion(client);
+    init_batch(client);
+
+    stream_to_client(client);
+}
+
+void stream_to_client(client_t *client) {
+    int result, batch_due;
+
     client->last_frame_time = get_now();
+    client->streaming = 1;
+
+    if (uring_eligible(client)) {
+        /* from now on, frames are sent from the main thread */
+        pthread_detach(pthread_self());
+        uring_add_client(client);
+
+        return;
+    }
+
+    if (timelapse_eligible(client) && timelapse_add_client(client) == 0) {
+        /* the client is left in the time-lapse scheduler until its next frame is due */
+        pthread_detach(pthread_self());
+
+        return;
+    }
 
     while (running) {
         if (pthread_mutex_lock(&jpeg_mutex)) {
@@ -274,29 +651,64 @@ void handle_client(client_t *client) {
             break;
         }
 
-        while (!client->jpeg_ready) {
-            if (pthread_cond_wait(&jpeg_cond, &jpeg_mutex)) {
+        batch_due = 0;
+        while (!client->jpeg_ready && !handoff_parking) {
+            if (client->batch_len && client->batch_int) {
+                /* a batch that's getting old is sent without waiting for more frames */
+                batch_due = wait_batch_deadline(client);
+                if (batch_due) {
+                    break;
+                }
+            }
+            else if (pthread_cond_wait(&jpeg_cond, &jpeg_mutex)) {
                 ERROR_CLIENT(client, "pthread_mutex_wait() failed");
                 pthread_mutex_unlock(&jpeg_mutex);
                 break;
             }
         }
 
-        /* copy the jpeg buffer into the client's temporary buffer,
-         * but first make sure there's enough space */
-        if (jpeg_size > client->jpeg_tmp_buf_max_size) {
-            DEBUG_CLIENT(client, "temporary buffer increased to %d bytes", jpeg_size);
-            client->jpeg_tmp_buf_max_size = jpeg_size;
-            client->jpeg_tmp_buf = realloc(client->jpeg_tmp_buf, client->jpeg_tmp_buf_max_size);
+        if (client->batch_len && (batch_due || handoff_parking)) {
+            /* made of whole frames, so parking for hand-off still happens at a frame boundary */
+            pthread_mutex_unlock(&jpeg_mutex);
+
+            result = send_frames(client);
+            if (result <= 0) {
+                break;
+            }
+
+            continue;
+        }
+
+        if (handoff_parking) {
+            /* we're at a frame boundary; the connection is left open,
+             * to be taken over by the new instance */
+            DEBUG_CLIENT(client, "parked for hand-off");
+            client->parked = 1;
+            pthread_cond_broadcast(&jpeg_cond);
+            pthread_mutex_unlock(&jpeg_mutex);
+
+            return;
         }
 
-        client->jpeg_tmp_buf_size = jpeg_size;
-        memcpy(client->jpeg_tmp_buf, jpeg_buf, client->jpeg_tmp_buf_size);
+        copy_frame_for_client(client);
 
         if (pthread_mutex_unlock(&jpeg_mutex)) {
             ERROR_CLIENT(client, "pthread_mutex_unlock() failed");
         }
 
+        crop_frame_for_client(client);
+
+        /* the frame's own motion score, for gating frames and for the X-Motion header */
+        client->jpeg_tmp_motion = -1;
+        if (client->motion_threshold || (!client->websocket && client->framing == FRAMING_MULTIPART)) {
+            client->jpeg_tmp_motion = motion_wait_score(client->jpeg_tmp_seq);
+        }
+
+        if (client->shed) {
+            INFO_CLIENT(client, "overloaded, shedding low priority client");
+            break;
+        }
+
         double now = get_now();
         client->frame_int = client->frame_int * 0.7 + (now - client->last_frame_time) * 0.3;
         client->last_frame_time = now;
@@ -306,28 +718,77 @@ void handle_client(client_t *client) {
         client->jpeg_ready = 0;
 
         if (!running) {
+            if (client->batch_len) {
+                send_frames(client); /* whatever's left of the stream */
+            }
+
             break; /* speeds up the shut down procedure a bit */
         }
 
-        DEBUG_CLIENT(client, "writing multipart header");
-        result = write_multipart_header(client, client->jpeg_tmp_buf_size);
-        if (result < 0) {
-            ERROR_CLIENT(client, "failed to write multipart header");
-            break;
+        if (client->websocket) {
+            result = websocket_read_messages(client);
+            if (result < 0) {
+                ERROR_CLIENT(client, "failed to read websocket messages");
+                break;
+            }
+            else if (result == 0) {
+                INFO_CLIENT(client, "connection closed");
+                break;
+            }
+
+            if (!websocket_can_send(client)) {
+                DEBUG_CLIENT(client, "too many unacknowledged frames, skipping frame %u", client->jpeg_tmp_seq);
+                client->frames_skipped++;
+                continue;
+            }
         }
-        else if (result == 0) {
-            INFO_CLIENT(client, "connection closed");
-            break;
+
+        if (client->interval) {
+            if (now < client->next_delivery) {
+                continue;
+            }
+
+            client->next_delivery = now + client->interval;
         }
 
-        DEBUG_CLIENT(client, "writing jpeg data (%d bytes)", client->jpeg_tmp_buf_size);
-        result = write_to_client(client, client->jpeg_tmp_buf, client->jpeg_tmp_buf_size);
-        if (result < 0) {
-            ERROR_CLIENT(client, "failed to write jpeg data");
-            break;
+        if (client->motion_threshold && client->jpeg_tmp_motion < client->motion_threshold) {
+            continue; /* nothing worth seeing, or a frame that wasn't analyzed */
+        }
+
+        /* under load, low priority clients make do with fewer frames */
+        if (load_skip_frame(client, client->jpeg_tmp_seq)) {
+            DEBUG_CLIENT(client, "overloaded, skipping frame %u", client->jpeg_tmp_seq);
+            client->frames_skipped++;
+            continue;
         }
-        else if (result == 0) {
-            INFO_CLIENT(client, "connection closed");
+
+        /* in live mode, rather than queuing a frame behind one that's still waiting to be sent,
+         * the client waits for the newest frame once the previous one is out */
+        if (client->live && !latency_drained(client)) {
+            DEBUG_CLIENT(client, "previous frame not sent yet, skipping frame %u", client->jpeg_tmp_seq);
+            client->frames_skipped++;
+            continue;
+        }
+
+        /* frames are skipped as a whole when running out of bandwidth,
+         * so that a constrained client still sees a coherent stream */
+        if (!rate_limiter_consume(&client->rate_limiter, client->jpeg_tmp_buf_size)) {
+            DEBUG_CLIENT(client, "rate limit reached, skipping frame %u", client->jpeg_tmp_seq);
+            client->frames_skipped++;
+            continue;
+        }
+
+        if (client->batch_max) {
+            queue_batch_frame(client, now);
+            if (client->batch_len < client->batch_max &&
+                    (!client->batch_int || now - client->batch_start < client->batch_int)) {
+
+                continue;
+            }
+        }
+
+        result = send_frames(client);
+        if (result <= 0) {
             break;
         }
     }
@@ -335,3 +796,219 @@ void handle_client(client_t *client) {
     cleanup_client(client);
 }
 
+
+void update_delivery_stats(client_t *client) {
+    double now = get_now(), interval = now - client->last_delivery_time;
+
+    if (client->last_delivery_time) {
+        if (client->delivery_int) {
+            client->delivery_jitter = update_jitter(client->delivery_jitter, interval, client->delivery_int);
+            client->delivery_jitter_max = MAX(client->delivery_jitter_max, interval > client->delivery_int ?
+                    interval - client->delivery_int : client->delivery_int - interval);
+            client->delivery_int = client->delivery_int * 0.7 + interval * 0.3;
+        }
+        else {
+            client->delivery_int = interval;
+        }
+    }
+
+    client->last_delivery_time = now;
+}
+
+void copy_frame_for_client(client_t *client) {
+    int size = jpeg_size;
+
+    client->jpeg_tmp_seq = jpeg_seq;
+    client->jpeg_tmp_timestamp = jpeg_timestamp;
+
+    if (client->egress_frame) {
+        egress_put(client->egress_frame);
+        client->egress_frame = NULL;
+    }
+
+    if (!client->crop && !client->batch_max) {
+        /* with zero-copy egress, taking a reference to the frame's memfd is all it takes */
+        client->egress_frame = egress_get();
+    }
+
+    client->jpeg_tmp_buf_size = size;
+    if (client->egress_frame) {
+        return;
+    }
+
+    /* copy the jpeg buffer into the client's temporary buffer,
+     * but first make sure there's enough space */
+    if (size > client->jpeg_tmp_buf_max_size) {
+        DEBUG_CLIENT(client, "temporary buffer increased to %d bytes", size);
+        client->jpeg_tmp_buf_max_size = size;
+        client->jpeg_tmp_buf = realloc(client->jpeg_tmp_buf, client->jpeg_tmp_buf_max_size);
+    }
+
+    memcpy(client->jpeg_tmp_buf, jpeg_buf, client->jpeg_tmp_buf_size);
+}
+
+void crop_frame_for_client(client_t *client) {
+    int size;
+
+    if (!client->crop) {
+        return;
+    }
+
+    /* called once the jpeg mutex is released; the region is cut once per frame,
+     * for all the clients asking for it, and the whole frame is sent when it can't be cut */
+    size = crop_get(client->crop, client->jpeg_tmp_seq, &client->jpeg_tmp_buf,
+            &client->jpeg_tmp_buf_max_size, client->jpeg_tmp_buf_size);
+    if (size >= 0) {
+        client->jpeg_tmp_buf_size = size;
+    }
+}
+
+int write_frame_data_to_client(client_t *client) {
+    if (client->egress_frame) {
+        return egress_send(client, client->egress_frame);
+    }
+
+    return write_to_client(client, client->jpeg_tmp_buf, client->jpeg_tmp_buf_size);
+}
+
+void queue_batch_frame(client_t *client, double now) {
+    batch_frame_t *frame = &client->batch[client->batch_len++];
+    char *buf = frame->buf;
+    int max_size = frame->max_size;
+
+    /* the frame changes hands, rather than being copied again; the client's
+     * temporary buffer is replaced by the one of a frame sent with an earlier batch */
+    frame->buf = client->jpeg_tmp_buf;
+    frame->max_size = client->jpeg_tmp_buf_max_size;
+    frame->size = client->jpeg_tmp_buf_size;
+    frame->seq = client->jpeg_tmp_seq;
+    frame->timestamp = client->jpeg_tmp_timestamp;
+    frame->motion = client->jpeg_tmp_motion;
+
+    client->jpeg_tmp_buf = buf;
+    client->jpeg_tmp_buf_max_size = max_size;
+
+    if (client->batch_len == 1) {
+        client->batch_start = now;
+    }
+    client->batch_bytes += frame->size;
+}
+
+int wait_batch_deadline(client_t *client) {
+    /* must be called with the jpeg mutex locked; tells whether the batch is due */
+    struct timespec ts;
+    double left = client->batch_start + client->batch_int - get_now();
+
+    if (left <= 0) {
+        return 1;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += (int) left;
+    ts.tv_nsec += (left - (int) left) * 1000000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+
+    return pthread_cond_timedwait(&jpeg_cond, &jpeg_mutex, &ts) == ETIMEDOUT;
+}
+
+int send_batch(client_t *client) {
+    struct iovec iov[2 * BATCH_MAX_FRAMES];
+    char headers[BATCH_MAX_FRAMES][MULTIPART_HEADER_LEN];
+    batch_frame_t *frame;
+    int i, len, size = 0;
+
+    for (i = 0; i < client->batch_len; i++) {
+        frame = &client->batch[i];
+        if (client->framing == FRAMING_LENGTH) {
+            len = format_length_header(headers[i], frame->size, frame->seq, frame->timestamp);
+        }
+        else {
+            len = format_multipart_header(headers[i], MULTIPART_HEADER_LEN, frame->size, frame->motion);
+        }
+
+        iov[2 * i].iov_base = headers[i];
+        iov[2 * i].iov_len = len;
+        iov[2 * i + 1].iov_base = frame->buf;
+        iov[2 * i + 1].iov_len = frame->size;
+        size += len + frame->size;
+    }
+
+    /* a single write for the whole batch */
+    DEBUG_CLIENT(client, "writing batch of %d frames (%d bytes)", client->batch_len, size);
+    int result = writev_to_client(client, iov, 2 * client->batch_len, size);
+    if (result < 0) {
+        ERROR_CLIENT(client, "failed to write batch");
+    }
+
+    return result;
+}
+
+int send_frames(client_t *client) {
+    int result, size, count = 1;
+
+    if (client->batch_max) {
+        size = client->batch_bytes;
+        count = client->batch_len;
+    }
+    else {
+        size = client->jpeg_tmp_buf_size;
+    }
+
+    if (load_enabled()) {
+        double cpu_start = load_cpu_time(), wall_start = get_now();
+        result = client->batch_max ? send_batch(client) : send_frame_to_client(client);
+        load_account(client, size, cpu_start, wall_start);
+    }
+    else {
+        result = client->batch_max ? send_batch(client) : send_frame_to_client(client);
+    }
+
+    client->batch_len = 0;
+    client->batch_bytes = 0;
+
+    if (result == 0) {
+        INFO_CLIENT(client, "connection closed");
+    }
+    if (result <= 0) {
+        return result;
+    }
+
+    client->frames_sent += count;
+    update_delivery_stats(client);
+
+    return result;
+}
+
+int send_frame_to_client(client_t *client) {
+    int result;
+
+    if (client->websocket) {
+        DEBUG_CLIENT(client, "writing websocket frame %u (%d bytes)", client->jpeg_tmp_seq, client->jpeg_tmp_buf_size);
+        result = websocket_write_frame(client);
+        if (result < 0) {
+            ERROR_CLIENT(client, "failed to write websocket frame");
+        }
+
+        return result;
+    }
+
+    DEBUG_CLIENT(client, "writing frame header");
+    result = write_multipart_header(client, client->jpeg_tmp_buf_size);
+    if (result < 0) {
+        ERROR_CLIENT(client, "failed to write frame header");
+    }
+    if (result <= 0) {
+        return result;
+    }
+
+    DEBUG_CLIENT(client, "writing jpeg data (%d bytes)", client->jpeg_tmp_buf_size);
+    result = write_frame_data_to_client(client);
+    if (result < 0) {
+        ERROR_CLIENT(client, "failed to write jpeg data");
+    }
+
+    return result;
+}
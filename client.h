@@ -20,6 +20,28 @@
 #ifndef __CLIENT_H
 #define __CLIENT_H
 
+#include "log.h"
+#include "ratelimit.h"
+#include "timerwheel.h"
+
+#define WS_MAX_UNACKED_LIMIT    64
+#define WS_RBUF_LEN             256
+#define MULTIPART_HEADER_LEN    128
+#define LENGTH_HEADER_LEN       16 /* frame length, sequence number and timestamp */
+#define BATCH_MAX_FRAMES        64
+
+#define FRAMING_MULTIPART       0
+#define FRAMING_LENGTH          1 /* each frame preceded by a compact binary header */
+
+typedef struct {
+    char *          buf;
+    int             size;
+    int             max_size;
+    unsigned int    seq;
+    double          timestamp;
+    double          motion; /* the frame's motion score, -1 if it wasn't analyzed */
+} batch_frame_t;
+
 typedef struct {
     int             stream_fd;
     char            addr[INET_ADDRSTRLEN];
@@ -34,12 +56,81 @@ typedef struct {
     char *          jpeg_tmp_buf;
     int             jpeg_tmp_buf_size;
     int             jpeg_tmp_buf_max_size;
+    unsigned int    jpeg_tmp_seq;
+    double          jpeg_tmp_timestamp;
+    double          jpeg_tmp_motion; /* the frame's motion score, -1 if it wasn't analyzed */
+    struct egress_frame *egress_frame; /* with zero-copy egress, the frame is sent from here instead */
+    struct crop *   crop; /* the region of the frames to send, NULL for whole frames */
+
+    int             http2; /* how the client came to speak HTTP/2, 0 for HTTP/1.x */
+    char            http2_settings[128]; /* from the upgrade request */
+    struct http2_conn *http2_conn;
+
+    int             websocket;
+    char            ws_key[32];
+    unsigned int    ws_unacked_seq[WS_MAX_UNACKED_LIMIT];
+    int             ws_unacked;
+    char            ws_rbuf[WS_RBUF_LEN];
+    int             ws_rbuf_len;
 
     double          frame_int;
     double          last_frame_time;
+    double          delivery_int; /* between frames written out */
+    double          last_delivery_time;
+    double          delivery_jitter;
+    double          delivery_jitter_max;
+
+    rate_limiter_t  rate_limiter;
+    log_limit_t     log_limit;
+
+    int             live;
+    double          interval; /* time-lapse delivery interval, in seconds, 0 for every frame */
+    double          next_delivery;
+    double          motion_threshold; /* frames are sent only while the motion score is at least this, 0 for all frames */
+
+    int             framing;
+    int             batch_max; /* frames sent together, 0 when not batching */
+    double          batch_int; /* the longest a batch waits for its last frame, in seconds, 0 for no limit */
+    batch_frame_t * batch;
+    int             batch_len;
+    int             batch_bytes;
+    double          batch_start;
+
+    int             uring; /* frames are sent by the io_uring engine, the client has no thread */
+    int             uring_inflight;
+    int             uring_failed;
+    int             uring_slot;
+    int             uring_len;
+    char            uring_header[MULTIPART_HEADER_LEN];
+    int             uring_header_len;
+
+    int             timelapse; /* frames are delivered by the time-lapse scheduler, the client has no thread */
+    wheel_timer_t   timelapse_timer;
+    struct timelapse_frame *timelapse_frame;
+    int             timelapse_offs;
+    double          timelapse_start;
+
+    int             priority; /* PRIORITY_LOW or PRIORITY_HIGH */
+    int             shed; /* to be disconnected, under load */
+
+    unsigned int    frames_sent;
+    unsigned int    frames_skipped;
+
+    int             streaming;
+    int             parked;
 } client_t;
 
 void                handle_client(client_t *client);
+void                resume_client(client_t *client);
+int                 write_to_client(client_t *client, char *buf, int size);
+int                 write_frame_data_to_client(client_t *client);
+int                 parse_request(client_t *client, char *buf);
+int                 find_uri_param(const char *uri, char *name, char *value, int len);
+int                 format_multipart_header(char *buf, int len, int jpeg_size, double motion);
+void                copy_frame_for_client(client_t *client);
+void                crop_frame_for_client(client_t *client);
+int                 send_frame_to_client(client_t *client);
+int                 send_batch(client_t *client);
 
 
 #endif /* __CLIENT_H */
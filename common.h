@@ -22,12 +22,14 @@
 
 #include <pthread.h>
 
-#define DEBUG(fmt, ...)                 if (log_level >= 2) fprintf(stderr, "%s: DEBUG: " fmt "\n", str_timestamp(), ##__VA_ARGS__)
-#define INFO(fmt, ...)                  if (log_level >= 1) fprintf(stderr, "%s: INFO : " fmt "\n", str_timestamp(), ##__VA_ARGS__)
-#define ERROR(fmt, ...)                 if (log_level >= 0) fprintf(stderr, "%s: ERROR: " fmt "\n", str_timestamp(), ##__VA_ARGS__)
+#include "log.h"
+
+#define DEBUG(fmt, ...)                 if (log_level >= 2) log_message(NULL, "DEBUG", fmt, ##__VA_ARGS__)
+#define INFO(fmt, ...)                  if (log_level >= 1) log_message(NULL, "INFO ", fmt, ##__VA_ARGS__)
+#define ERROR(fmt, ...)                 if (log_level >= 0) log_message(NULL, "ERROR", fmt, ##__VA_ARGS__)
 #define ERRNO(msg)                      ERROR("%s: %s", msg, strerror(errno))
-#define DEBUG_CLIENT(client, fmt, ...)  DEBUG("%s:%d: " fmt, client->addr, client->port, ##__VA_ARGS__)
-#define INFO_CLIENT(client, fmt, ...)   INFO("%s:%d: " fmt, client->addr, client->port, ##__VA_ARGS__)
+#define DEBUG_CLIENT(client, fmt, ...)  if (log_level >= 2) log_message(&(client)->log_limit, "DEBUG", "%s:%d: " fmt, client->addr, client->port, ##__VA_ARGS__)
+#define INFO_CLIENT(client, fmt, ...)   if (log_level >= 1) log_message(&(client)->log_limit, "INFO ", "%s:%d: " fmt, client->addr, client->port, ##__VA_ARGS__)
 #define ERROR_CLIENT(client, fmt, ...)  ERROR("%s:%d: " fmt, client->addr, client->port, ##__VA_ARGS__)
 #define ERRNO_CLIENT(client, msg)       ERROR_CLIENT(client, "%s: %s", msg, strerror(errno))
 
@@ -35,15 +37,23 @@
 #define MAX(a, b)                       ((a) > (b) ? (a) : (b))
 
 extern int                              log_level;
-extern char                             jpeg_buf[];
+extern char *                           jpeg_buf;
 extern int                              jpeg_size;
+extern unsigned int                     jpeg_seq;
+extern double                           jpeg_timestamp;
+extern int                              jpeg_width;
+extern int                              jpeg_height;
+extern const char *                     jpeg_subsampling;
 extern int                              running;
+extern int                              num_clients;
 extern pthread_cond_t                   jpeg_cond;
 extern pthread_mutex_t                  jpeg_mutex;
 
 
 char *                                  str_timestamp();
 double                                  get_now();
+double                                  get_wall_time();
+double                                  get_input_jitter();
 
 
 #endif /* __COMMON_H */
@@ -0,0 +1,498 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "streameye.h"
+#include "common.h"
+#include "jpeg.h"
+#include "crop.h"
+
+
+/* regions are cut losslessly, in the DCT domain, much like jpegtran -crop does: the entropy coded
+ * data of the frame is huffman-decoded just enough to find where each block starts and ends, but
+ * never dequantized nor transformed. The AC coefficients of a block don't depend on its neighbors,
+ * so their bits are copied as they are; only the DC coefficients, coded as differences from the
+ * previous block, are coded again, using the standard DC tables, which cover every difference.
+ * Nothing happens when a frame is published: the first client asking for a region of a new frame,
+ * with its own copy of it, has the frame indexed, once, and each distinct region is cut from that
+ * index once, to be shared by all the clients streaming it; this keeps the decoding away from the
+ * input thread and the jpeg mutex. */
+
+
+typedef struct {
+    unsigned short  code[16];
+    unsigned char   len[16];
+} dc_encoder_t;
+
+typedef struct {
+    unsigned char * buf;
+    int             len;
+    uint32_t        acc;
+    int             bits;
+} bit_writer_t;
+
+
+    /* locals */
+
+static pthread_mutex_t crops_mutex = PTHREAD_MUTEX_INITIALIZER;
+static crop_t *crops = NULL;
+
+static dc_encoder_t dc_encoders[2];
+static int dc_encoders_ready = 0;
+
+/* the last frame asked for and its index, which refers to the frame's headers */
+static char *frame_buf = NULL;
+static int frame_max_size = 0;
+static jpeg_index_t frame_index;
+static jpeg_info_t *info = &frame_index.info;
+static unsigned int index_seq = 0;
+static int index_ready = 0;
+static int index_failed = 0;
+static int failing = 0; /* whether frames have been failing to be cropped, so that it's logged only once */
+
+
+    /* local functions */
+
+static int          parse_spec(char *spec, int *x, int *y, int *w, int *h);
+static void         init_dc_encoder(dc_encoder_t *enc, const unsigned char *table);
+static int          index_frame(unsigned int seq, char *buf, int size);
+static int          ensure_indexed(int num_mcus);
+static int          region_mcus(crop_t *crop);
+static int          cut(crop_t *crop);
+static void         update(crop_t *crop, unsigned int seq, char *buf, int size);
+
+
+    /* bit level helpers */
+
+static inline void put_bits(bit_writer_t *writer, unsigned int value, int n) {
+    unsigned char byte;
+
+    /* n must be at most 24 */
+    writer->acc = writer->acc << n | (value & ((1U << n) - 1));
+    writer->bits += n;
+
+    while (writer->bits >= 8) {
+        writer->bits -= 8;
+        byte = writer->acc >> writer->bits;
+        writer->buf[writer->len++] = byte;
+        if (byte == 0xFF) {
+            writer->buf[writer->len++] = 0; /* stuffing */
+        }
+    }
+}
+
+static inline void copy_bits(bit_writer_t *writer, unsigned int offs, int n) {
+    int chunk;
+
+    while (n > 0) {
+        chunk = MIN(n, 24);
+        put_bits(writer, jpeg_peek_bits(frame_index.data, offs, chunk), chunk);
+        offs += chunk;
+        n -= chunk;
+    }
+}
+
+
+    /* tables */
+
+void init_dc_encoder(dc_encoder_t *enc, const unsigned char *table) {
+    int len, i, code = 0, k = 0;
+
+    for (len = 1; len <= 16; len++) {
+        for (i = 0; i < table[len - 1]; i++, code++, k++) {
+            enc->code[table[16 + k]] = code;
+            enc->len[table[16 + k]] = len;
+        }
+
+        code <<= 1;
+    }
+}
+
+
+    /* indexing */
+
+int index_frame(unsigned int seq, char *buf, int size) {
+    /* must be called with the crops mutex locked */
+    crop_t *crop;
+    int num_mcus = 0;
+
+    if (index_ready && index_seq == seq) {
+        return index_failed ? -1 : 0;
+    }
+
+    /* the buffer belongs to the client, which may reuse it as soon as it's done */
+    if (size > frame_max_size) {
+        frame_max_size = size;
+        frame_buf = realloc(frame_buf, frame_max_size);
+    }
+    memcpy(frame_buf, buf, size);
+
+    index_ready = 1;
+    index_seq = seq;
+
+    if (jpeg_index_frame(&frame_index, (unsigned char *) frame_buf, size) < 0) {
+        if (!failing) {
+            ERROR("crop: frame %u can't be cropped losslessly, sending whole frames", seq);
+        }
+        index_failed = failing = 1;
+
+        return -1;
+    }
+
+    index_failed = 0;
+
+    /* the frame is decoded once, as far as the lowest region goes */
+    for (crop = crops; crop; crop = crop->next) {
+        num_mcus = MAX(num_mcus, region_mcus(crop));
+    }
+
+    return ensure_indexed(num_mcus);
+}
+
+int ensure_indexed(int num_mcus) {
+    if (jpeg_index_blocks(&frame_index, num_mcus) < 0) {
+        if (!failing) {
+            ERROR("crop: failed to decode frame %u, sending whole frames", index_seq);
+        }
+        index_failed = failing = 1;
+
+        return -1;
+    }
+
+    return 0;
+}
+
+
+    /* cutting */
+
+int region_mcus(crop_t *crop) {
+    int y, h;
+
+    if (crop->x >= info->width || crop->y >= info->height) {
+        return 0;
+    }
+
+    y = crop->y / frame_index.mcu_h * frame_index.mcu_h;
+    h = MIN(crop->y + crop->h, info->height) - y;
+
+    return (y / frame_index.mcu_h + (h + frame_index.mcu_h - 1) / frame_index.mcu_h) * frame_index.mcus_x;
+}
+
+int cut(crop_t *crop) {
+    const unsigned char *table, *seg;
+    int pred[JPEG_MAX_COMPONENTS];
+    int x, y, w, h, mx, my, cx, cy, b, c, s, diff, i, offs, seg_len, marker, used;
+    jpeg_block_t *block;
+    bit_writer_t writer;
+    char *p;
+
+    if (crop->x >= info->width || crop->y >= info->height) {
+        return -1;
+    }
+
+    /* the region starts at an MCU boundary and grows accordingly, so that it still covers what was asked */
+    x = crop->x / frame_index.mcu_w * frame_index.mcu_w;
+    y = crop->y / frame_index.mcu_h * frame_index.mcu_h;
+    w = MIN(crop->x + crop->w, info->width) - x;
+    h = MIN(crop->y + crop->h, info->height) - y;
+    cx = (w + frame_index.mcu_w - 1) / frame_index.mcu_w;
+    cy = (h + frame_index.mcu_h - 1) / frame_index.mcu_h;
+
+    if (ensure_indexed(region_mcus(crop)) < 0) {
+        return -1;
+    }
+
+    /* stuffing may at most double the size of the data; each DC coefficient may take up to 3 bytes */
+    i = info->scan_offset + 1024 + 2 * (info->scan_len + 3 * cx * cy * frame_index.blocks_per_mcu);
+    if (i > crop->max_size) {
+        crop->max_size = i;
+        crop->buf = realloc(crop->buf, crop->max_size);
+    }
+
+    p = crop->buf;
+    *p++ = 0xFF;
+    *p++ = JPEG_MARKER_SOI;
+
+    /* keep all the header segments, except those that are rewritten */
+    for (offs = 2; offs + 4 <= info->scan_offset; offs += 2 + seg_len) {
+        seg = (unsigned char *) frame_buf + offs;
+        marker = seg[1];
+        if (marker == 0xFF) {
+            offs--; /* fill byte */
+            seg_len = 0;
+            continue;
+        }
+
+        seg_len = seg[2] << 8 | seg[3];
+        if (marker == JPEG_MARKER_SOS) {
+            break;
+        }
+
+        if (marker != JPEG_MARKER_SOF0 && marker != JPEG_MARKER_SOF1 && marker != JPEG_MARKER_DHT &&
+            marker != JPEG_MARKER_DRI) {
+
+            memcpy(p, seg, 2 + seg_len);
+            p += 2 + seg_len;
+        }
+    }
+
+    /* frame header, with the size of the region */
+    used = 0;
+    for (c = 0; c < info->scan_num_components; c++) {
+        used |= info->scan_ac_table[c] > 1;
+    }
+
+    *p++ = 0xFF;
+    *p++ = used ? JPEG_MARKER_SOF1 : JPEG_MARKER_SOF0;
+    *p++ = 0;
+    *p++ = 8 + 3 * info->num_components;
+    *p++ = 8;
+    *p++ = h >> 8;
+    *p++ = h;
+    *p++ = w >> 8;
+    *p++ = w;
+    *p++ = info->num_components;
+    for (c = 0; c < info->num_components; c++) {
+        *p++ = info->component_id[c];
+        *p++ = info->h_samp[c] << 4 | info->v_samp[c];
+        *p++ = info->tq[c];
+    }
+
+    /* huffman tables: the standard DC ones and the original AC ones */
+    *p++ = 0xFF;
+    *p++ = JPEG_MARKER_DHT;
+    i = p - crop->buf;
+    p += 2;
+    for (c = 0; c < 2; c++) {
+        table = c ? jpeg_std_dc_chrominance : jpeg_std_dc_luminance;
+        *p++ = c;
+        memcpy(p, table, jpeg_huffman_table_len(table));
+        p += jpeg_huffman_table_len(table);
+    }
+
+    used = 0;
+    for (c = 0; c < info->scan_num_components; c++) {
+        if (used & (1 << info->scan_ac_table[c])) {
+            continue;
+        }
+        used |= 1 << info->scan_ac_table[c];
+
+        table = jpeg_huffman_table(info, 1, info->scan_ac_table[c]);
+        *p++ = 0x10 | info->scan_ac_table[c];
+        memcpy(p, table, jpeg_huffman_table_len(table));
+        p += jpeg_huffman_table_len(table);
+    }
+    crop->buf[i] = (p - crop->buf - i) >> 8;
+    crop->buf[i + 1] = p - crop->buf - i;
+
+    /* scan header */
+    *p++ = 0xFF;
+    *p++ = JPEG_MARKER_SOS;
+    *p++ = 0;
+    *p++ = 6 + 2 * info->scan_num_components;
+    *p++ = info->scan_num_components;
+    for (c = 0; c < info->scan_num_components; c++) {
+        *p++ = info->component_id[info->scan_component[c]];
+        *p++ = (info->scan_dc_table[c] ? 0x10 : 0x00) | info->scan_ac_table[c];
+    }
+    *p++ = 0;
+    *p++ = 63;
+    *p++ = 0;
+
+    /* entropy coded data */
+    writer.buf = (unsigned char *) p;
+    writer.len = 0;
+    writer.acc = 0;
+    writer.bits = 0;
+    memset(pred, 0, sizeof(pred));
+
+    for (my = y / frame_index.mcu_h; my < y / frame_index.mcu_h + cy; my++) {
+        for (mx = x / frame_index.mcu_w; mx < x / frame_index.mcu_w + cx; mx++) {
+            block = frame_index.blocks + (my * frame_index.mcus_x + mx) * frame_index.blocks_per_mcu;
+            for (b = 0; b < frame_index.blocks_per_mcu; b++, block++) {
+                c = frame_index.block_component[b];
+                diff = block->dc - pred[c];
+                pred[c] = block->dc;
+
+                for (s = 0, i = abs(diff); i; i >>= 1) {
+                    s++;
+                }
+                if (s > JPEG_MAX_DC_CATEGORY) {
+                    return -1;
+                }
+
+                i = info->scan_dc_table[c] ? 1 : 0;
+                put_bits(&writer, dc_encoders[i].code[s], dc_encoders[i].len[s]);
+                put_bits(&writer, diff < 0 ? diff - 1 : diff, s);
+
+                copy_bits(&writer, block->ac_offs, block->ac_len);
+            }
+        }
+    }
+
+    if (writer.bits) {
+        put_bits(&writer, 0xFF, 8 - writer.bits); /* padding */
+    }
+
+    p += writer.len;
+    *p++ = 0xFF;
+    *p++ = JPEG_MARKER_EOI;
+
+    failing = 0;
+
+    return p - crop->buf;
+}
+
+
+    /* sharing */
+
+int parse_spec(char *spec, int *x, int *y, int *w, int *h) {
+    char *end;
+
+    *x = strtol(spec, &end, 10);
+    if (*end != ',' || *x < 0) {
+        return -1;
+    }
+    *y = strtol(end + 1, &end, 10);
+    if (*end != ',' || *y < 0) {
+        return -1;
+    }
+    *w = strtol(end + 1, &end, 10);
+    if (*end != ',' || *w <= 0) {
+        return -1;
+    }
+    *h = strtol(end + 1, &end, 10);
+    if (*end != 0 || *h <= 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+crop_t *crop_acquire(char *spec) {
+    int x, y, w, h;
+    crop_t *crop;
+
+    if (parse_spec(spec, &x, &y, &w, &h) < 0) {
+        return NULL;
+    }
+
+    if (pthread_mutex_lock(&crops_mutex)) {
+        ERROR("pthread_mutex_lock() failed");
+        return NULL;
+    }
+
+    if (!dc_encoders_ready) {
+        init_dc_encoder(&dc_encoders[0], jpeg_std_dc_luminance);
+        init_dc_encoder(&dc_encoders[1], jpeg_std_dc_chrominance);
+        dc_encoders_ready = 1;
+    }
+
+    for (crop = crops; crop; crop = crop->next) {
+        if (crop->x == x && crop->y == y && crop->w == w && crop->h == h) {
+            break;
+        }
+    }
+
+    if (!crop) {
+        crop = malloc(sizeof(crop_t));
+        memset(crop, 0, sizeof(crop_t));
+        crop->x = x;
+        crop->y = y;
+        crop->w = w;
+        crop->h = h;
+        crop->next = crops;
+        crops = crop;
+        DEBUG("crop: new region %dx%d at %d,%d", w, h, x, y);
+    }
+
+    crop->refs++;
+
+    pthread_mutex_unlock(&crops_mutex);
+
+    return crop;
+}
+
+void crop_release(crop_t *crop) {
+    crop_t **c;
+
+    if (pthread_mutex_lock(&crops_mutex)) {
+        ERROR("pthread_mutex_lock() failed");
+        return;
+    }
+
+    if (--crop->refs == 0) {
+        for (c = &crops; *c; c = &(*c)->next) {
+            if (*c == crop) {
+                *c = crop->next;
+                break;
+            }
+        }
+
+        DEBUG("crop: region %dx%d at %d,%d no longer used", crop->w, crop->h, crop->x, crop->y);
+        free(crop->buf);
+        free(crop);
+    }
+
+    pthread_mutex_unlock(&crops_mutex);
+}
+
+void update(crop_t *crop, unsigned int seq, char *buf, int size) {
+    /* must be called with the crops mutex locked */
+    if (crop->ready && crop->seq == seq) {
+        return;
+    }
+
+    crop->ready = 1;
+    crop->seq = seq;
+    crop->size = index_frame(seq, buf, size) < 0 ? -1 : cut(crop);
+}
+
+int crop_get(crop_t *crop, unsigned int seq, char **buf, int *max_size, int size) {
+    int result;
+
+    /* called without the jpeg mutex, with the client's own copy of the frame,
+     * which is replaced by the region; it's left as it is when it can't be cut */
+    if (pthread_mutex_lock(&crops_mutex)) {
+        ERROR("pthread_mutex_lock() failed");
+        return -1;
+    }
+
+    update(crop, seq, *buf, size);
+
+    result = crop->size;
+    if (result >= 0) {
+        if (result > *max_size) {
+            *max_size = result;
+            *buf = realloc(*buf, *max_size);
+        }
+
+        memcpy(*buf, crop->buf, result);
+    }
+
+    pthread_mutex_unlock(&crops_mutex);
+
+    return result;
+}
@@ -0,0 +1,45 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CROP_H
+#define __CROP_H
+
+typedef struct crop {
+    int             x;
+    int             y;
+    int             w;
+    int             h;
+    int             refs; /* clients streaming this region */
+
+    unsigned int    seq; /* of the frame the region was cut from */
+    int             ready;
+    char *          buf;
+    int             size; /* -1 when the frame could not be cropped */
+    int             max_size;
+
+    struct crop *   next;
+} crop_t;
+
+
+crop_t *            crop_acquire(char *spec);
+void                crop_release(crop_t *crop);
+int                 crop_get(crop_t *crop, unsigned int seq, char **buf, int *max_size, int size);
+
+
+#endif /* __CROP_H */
@@ -0,0 +1,131 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <arpa/inet.h>
+
+#include "streameye.h"
+#include "common.h"
+#include "egress.h"
+
+
+/* rather than having each client thread copy the frame into its own buffer and then write() it
+ * into its socket (a second copy), every published frame is written once into a memfd of its own
+ * and sent to clients with sendfile(), which hands the page cache pages to the socket. A memfd is
+ * never written again once published: in-flight socket buffers still reference its pages after
+ * sendfile() returns, so each frame gets a fresh one, closed when its last sender lets go of it. */
+
+
+    /* locals */
+
+static int enabled = 0;
+static egress_frame_t *current = NULL; /* the last published frame, protected by the jpeg mutex */
+
+
+void egress_init(int enable) {
+    enabled = enable;
+}
+
+int egress_enabled() {
+    return enabled;
+}
+
+void egress_publish(char *buf, int size) {
+    /* must be called with the jpeg mutex locked */
+    egress_frame_t *frame;
+    int fd;
+
+    if (!enabled) {
+        return;
+    }
+
+    if (current) {
+        egress_put(current);
+        current = NULL;
+    }
+
+    fd = memfd_create("streameye-frame", MFD_CLOEXEC);
+    if (fd < 0) {
+        ERRNO("egress: memfd_create() failed");
+        return; /* clients fall back to copying the frame */
+    }
+
+    if (write(fd, buf, size) != size) {
+        ERRNO("egress: write() failed");
+        close(fd);
+        return;
+    }
+
+    frame = malloc(sizeof(egress_frame_t));
+    frame->refs = 1;
+    frame->fd = fd;
+    frame->size = size;
+
+    current = frame;
+}
+
+egress_frame_t *egress_get() {
+    /* must be called with the jpeg mutex locked */
+    if (current) {
+        __atomic_add_fetch(&current->refs, 1, __ATOMIC_RELAXED);
+    }
+
+    return current;
+}
+
+void egress_put(egress_frame_t *frame) {
+    if (__atomic_sub_fetch(&frame->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        close(frame->fd);
+        free(frame);
+    }
+}
+
+int egress_send(client_t *client, egress_frame_t *frame) {
+    off_t offset = 0;
+    ssize_t sent;
+
+    while (offset < frame->size) {
+        sent = sendfile(client->stream_fd, frame->fd, &offset, frame->size - offset);
+        if (sent < 0) {
+            if (errno == EPIPE || errno == EINTR) {
+                return 0;
+            }
+            else {
+                ERRNO_CLIENT(client, "sendfile() failed");
+                return -1;
+            }
+        }
+        else if (sent == 0) {
+            break;
+        }
+    }
+
+    if (offset < frame->size) {
+        ERROR_CLIENT(client, "not all data could be written");
+        return -1;
+    }
+
+    return frame->size;
+}
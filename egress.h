@@ -0,0 +1,40 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __EGRESS_H
+#define __EGRESS_H
+
+#include "client.h"
+
+typedef struct egress_frame {
+    int             refs;
+    int             fd; /* the memfd holding the frame */
+    int             size;
+} egress_frame_t;
+
+
+void                egress_init(int enable);
+int                 egress_enabled();
+void                egress_publish(char *buf, int size);
+egress_frame_t *    egress_get();
+void                egress_put(egress_frame_t *frame);
+int                 egress_send(client_t *client, egress_frame_t *frame);
+
+
+#endif /* __EGRESS_H */
@@ -0,0 +1,281 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Reference producer for the streamEye memfd input (-I): loops over a set of JPEG files, sending them
+ * as frames at a given rate, either in a sealed memfd per frame or through a ring of slots in one
+ * shared memfd (-r).
+ *
+ *     make memfd_producer
+ *     streameye -I /tmp/streameye.sock &
+ *     extras/memfd_producer -f 10 -r 4 /tmp/streameye.sock *.jpg
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "streameye_memfd.h"
+
+
+#define RELEASE_TIMEOUT         1000 /* milliseconds */
+#define RECONNECT_INTERVAL      1 /* seconds */
+
+
+typedef struct {
+    char *data;
+    size_t len;
+} file_t;
+
+
+static char *socket_path;
+static file_t *files;
+static int num_files;
+static int num_slots; /* 0 for a memfd per frame */
+static size_t slot_len;
+static int ring_fd = -1;
+static char *ring;
+static int *slot_busy;
+
+
+static int load_file(const char *path, file_t *file) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        return -1;
+    }
+
+    file->len = st.st_size;
+    file->data = malloc(file->len);
+    if (!file->data || read(fd, file->data, file->len) != (ssize_t) file->len) {
+        fprintf(stderr, "%s: failed to read file\n", path);
+        close(fd);
+        return -1;
+    }
+
+    close(fd);
+
+    return 0;
+}
+
+static int create_ring() {
+    long page_size = sysconf(_SC_PAGESIZE);
+    int i;
+
+    for (i = 0; i < num_files; i++) {
+        if (files[i].len > slot_len) {
+            slot_len = files[i].len;
+        }
+    }
+    slot_len = (slot_len + page_size - 1) / page_size * page_size;
+
+    ring_fd = memfd_create("streameye-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (ring_fd < 0 || ftruncate(ring_fd, slot_len * num_slots) < 0) {
+        perror("memfd_create");
+        return -1;
+    }
+
+    ring = mmap(NULL, slot_len * num_slots, PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd, 0);
+    if (ring == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+
+    /* streamEye maps the whole memfd, so it must not be able to shrink; once mapped here,
+     * this mapping is the only one left that can write to it */
+    if (fcntl(ring_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_FUTURE_WRITE | F_SEAL_SEAL) < 0) {
+        perror("fcntl");
+        return -1;
+    }
+
+    slot_busy = calloc(num_slots, sizeof(int));
+
+    return 0;
+}
+
+static int send_sealed(int sock, uint32_t id, file_t *file) {
+    int fd = memfd_create("streameye-frame", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    int r;
+
+    if (fd < 0) {
+        perror("memfd_create");
+        return -1;
+    }
+
+    if (write(fd, file->data, file->len) != (ssize_t) file->len ||
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+
+        perror("memfd");
+        close(fd);
+        return -1;
+    }
+
+    r = se_memfd_send(sock, fd, id, 0, file->len);
+    close(fd); /* streamEye holds its own reference from now on */
+
+    return r;
+}
+
+static int send_slot(int sock, uint32_t id, file_t *file, int first) {
+    int slot = id % num_slots;
+    uint32_t released;
+    int r;
+
+    /* a slot may only be overwritten once streamEye has released the frame it holds */
+    while (slot_busy[slot]) {
+        r = se_memfd_wait_release(sock, RELEASE_TIMEOUT, &released);
+        if (r < 0) {
+            return -1;
+        }
+        else if (r == 0) {
+            fprintf(stderr, "timeout waiting for slot %d to be released\n", slot);
+            return -1;
+        }
+
+        slot_busy[released % num_slots] = 0;
+    }
+
+    memcpy(ring + slot * slot_len, file->data, file->len);
+    slot_busy[slot] = 1;
+
+    return se_memfd_send(sock, first ? ring_fd : -1, id, slot * slot_len, file->len);
+}
+
+static void drain_releases(int sock) {
+    uint32_t released;
+
+    while (se_memfd_wait_release(sock, 0, &released) > 0) {
+        if (num_slots) {
+            slot_busy[released % num_slots] = 0;
+        }
+    }
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: memfd_producer [-f fps] [-r slots] <socket> <file.jpg>...\n");
+    fprintf(stderr, "    -f fps             frame rate (defaults to 10)\n");
+    fprintf(stderr, "    -r slots           write frames into a ring of slots in a single shared memfd,\n");
+    fprintf(stderr, "                       instead of using a sealed memfd per frame\n");
+}
+
+int main(int argc, char *argv[]) {
+    struct timespec next;
+    double fps = 10;
+    uint32_t id = 0;
+    int sock = -1, first = 1, r, c, i;
+
+    while ((c = getopt(argc, argv, "f:r:h")) != -1) {
+        switch (c) {
+            case 'f':
+                fps = strtod(optarg, NULL);
+                if (fps <= 0) {
+                    fprintf(stderr, "invalid frame rate: %s\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'r':
+                num_slots = strtol(optarg, NULL, 10);
+                if (num_slots < 2) {
+                    fprintf(stderr, "at least 2 slots are needed\n");
+                    return 1;
+                }
+                break;
+
+            default:
+                usage();
+                return c == 'h' ? 0 : 1;
+        }
+    }
+
+    if (argc - optind < 2) {
+        usage();
+        return 1;
+    }
+
+    socket_path = argv[optind];
+    num_files = argc - optind - 1;
+    files = calloc(num_files, sizeof(file_t));
+    for (i = 0; i < num_files; i++) {
+        if (load_file(argv[optind + 1 + i], &files[i]) < 0) {
+            return 1;
+        }
+    }
+
+    if (num_slots && create_ring() < 0) {
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (1) {
+        if (sock < 0) {
+            sock = se_memfd_connect(socket_path);
+            if (sock < 0) {
+                sleep(RECONNECT_INTERVAL);
+                clock_gettime(CLOCK_MONOTONIC, &next);
+                continue;
+            }
+
+            /* a new connection starts with no frames in use and needs the shared memfd again */
+            if (num_slots) {
+                memset(slot_busy, 0, num_slots * sizeof(int));
+            }
+            first = 1;
+            fprintf(stderr, "connected to %s\n", socket_path);
+        }
+
+        drain_releases(sock);
+
+        if (num_slots) {
+            r = send_slot(sock, id, &files[id % num_files], first);
+        }
+        else {
+            r = send_sealed(sock, id, &files[id % num_files]);
+        }
+
+        if (r < 0) {
+            fprintf(stderr, "disconnected from %s\n", socket_path);
+            close(sock);
+            sock = -1;
+            continue;
+        }
+
+        first = 0;
+        id++;
+
+        next.tv_nsec += 1e9 / fps;
+        next.tv_sec += next.tv_nsec / 1000000000;
+        next.tv_nsec %= 1000000000;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+
+    return 0;
+}
@@ -18,11 +18,14 @@
 
 
 import argparse
+import errno
 import io
 import logging
+import os
 import picamera
 import signal
 import sys
+import threading
 import time
 
 
@@ -31,6 +34,8 @@ VERSION = '0.8'
 options = None
 camera = None
 running = True
+paused = False
+resumed = threading.Event()
 
 def configure_signals():
     def bye_handler(signal, frame):
@@ -132,6 +137,11 @@ def parse_options():
     parser.add_argument('--colfx', help='color effect (U:V format, 0 to 255, e.g. 128:128)',
             type=colfx_arg, dest='colfx', default=None)
 
+    parser.add_argument('--control', help='control FIFO through which streamEye asks for a pause when nobody is watching',
+            type=str, dest='control', default=None)
+    parser.add_argument('--idle-framerate', help='number of frames per second while paused (0 to stop capturing, defaults to 1)',
+            type=float, dest='idle_framerate', default=1)
+
     parser.add_argument('-s', '--stills', help='use stills mode instead of video mode (considerably slower)',
             action='store_true', dest='stills', default=False)
     parser.add_argument('-d', '--debug', help='debug mode, increase verbosity',
@@ -203,6 +213,7 @@ def parse_options():
     validate_or_exit('width', min=64, max=3280, required=True)
     validate_or_exit('height', min=64, max=2464, required=True)
     validate_or_exit('framerate', min=0.1, max=90, required=True)
+    validate_or_exit('idle_framerate', min=0, max=90)
     validate_or_exit('quality', min=1, max=100)
     
     validate_or_exit('preview_width', min=64, max=3280, required=False)
@@ -306,8 +317,53 @@ if sys.version_info.major >= 3:
 else:
     my_stdout = sys.stdout
 
+def start_control():
+    def read_control():
+        global paused
+
+        # opened for both reading and writing, so that it never blocks nor sees an end of file
+        fd = os.open(options.control, os.O_RDWR)
+        control = os.fdopen(fd, 'r')
+
+        while running:
+            line = control.readline().strip()
+            if line == 'pause' and not paused:
+                logging.info('pausing capture')
+                resumed.clear()
+                paused = True
+
+            elif line == 'resume' and paused:
+                logging.info('resuming capture')
+                paused = False
+                resumed.set()
+
+    try:
+        os.mkfifo(options.control, 0o600)
+
+    except OSError as e:
+        if e.errno != errno.EEXIST:
+            raise
+
+    logging.debug('using control FIFO %s' % options.control)
+
+    thread = threading.Thread(target=read_control)
+    thread.daemon = True
+    thread.start()
+
+
 def streams_iter():
+    last_time = 0
+
     while running:
+        if paused:
+            # frames are captured at the idle frame rate (if at all) until resumed
+            if options.idle_framerate:
+                resumed.wait(max(0, last_time + 1.0 / options.idle_framerate - time.time()))
+
+            else:
+                resumed.wait()
+
+        last_time = time.time()
         yield my_stdout
         sys.stdout.flush()
 
@@ -328,6 +384,9 @@ if __name__ == '__main__':
     logging.info('raspimjpeg.py %s' % VERSION)
     logging.info('hello!')
     init_camera()
+    if options.control:
+        start_control()
+
     run()
     logging.info('bye!')
 
@@ -0,0 +1,569 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Reference receiver for the streamEye RTP/JPEG output (-M): joins the multicast group, reassembles
+ * the frames from their RTP/JPEG packets (RFC 2435, types 0 and 1, with or without restart markers,
+ * with in-band quantization tables) and rebuilds complete JPEG images from them. When given the JPEG
+ * files fed to streamEye, each rebuilt frame is checked against the one carrying the same
+ * entropy coded data:
+ *
+ *     make rtp_receiver
+ *     streameye -M 239.0.0.1:5004:127.0.0.1 < frames.mjpg &
+ *     extras/rtp_receiver -n 100 239.0.0.1:5004:127.0.0.1 *.jpg
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "jpeg.h"
+
+
+#define RTP_PAYLOAD_TYPE_JPEG   26
+#define RTP_HEADER_LEN          12
+#define MAX_PACKET_LEN          65536
+#define MAX_FRAME_LEN           1024 * 1024 * 10 /* 10MB */
+#define MAX_HEADERS_LEN         1024 /* the rebuilt JPEG headers */
+#define DEF_TIMEOUT             5 /* seconds */
+
+
+typedef struct {
+    char *          path;
+    unsigned char * data;
+    int             len;
+    jpeg_info_t     info;
+} reference_t;
+
+typedef struct {
+    uint32_t        timestamp;
+    uint16_t        next_seq;
+    int             started;
+    int             broken; /* a packet was lost, the rest of the frame is ignored */
+    int             type;
+    int             width;
+    int             height;
+    int             restart_interval;
+    unsigned char   qtables[128];
+    int             num_packets;
+    unsigned char * data; /* the entropy coded data, after room for the headers */
+    int             len;
+} frame_t;
+
+
+static reference_t *references;
+static int num_references;
+static unsigned char qtable_cache[256][128]; /* in-band tables by Q, for when they're not repeated */
+static int qtable_cached[256];
+static frame_t frame;
+static FILE *output;
+
+static int frames_ok;
+static int frames_bad;
+static int frames_broken;
+
+
+static int load_reference(const char *path, reference_t *ref) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        return -1;
+    }
+
+    ref->path = strdup(path);
+    ref->len = st.st_size;
+    ref->data = malloc(ref->len);
+    if (!ref->data || read(fd, ref->data, ref->len) != ref->len) {
+        fprintf(stderr, "%s: failed to read file\n", path);
+        close(fd);
+        return -1;
+    }
+
+    close(fd);
+
+    if (jpeg_parse(ref->data, ref->len, &ref->info) < 0) {
+        fprintf(stderr, "%s: not a valid jpeg file\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int open_socket(char *spec) {
+    char group[INET_ADDRSTRLEN];
+    char iface[INET_ADDRSTRLEN] = "";
+    struct sockaddr_in addr;
+    struct ip_mreq mreq;
+    int port = 0, fd, one = 1;
+
+    if (sscanf(spec, "%15[^:]:%d:%15s", group, &port, iface) < 2 || port <= 0 || port > 65535) {
+        fprintf(stderr, "invalid multicast address: %s\n", spec);
+        return -1;
+    }
+
+    memset(&mreq, 0, sizeof(mreq));
+    if (!inet_aton(group, &mreq.imr_multiaddr) || (iface[0] && !inet_aton(iface, &mreq.imr_interface))) {
+        fprintf(stderr, "invalid multicast address: %s\n", spec);
+        return -1;
+    }
+
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr = mreq.imr_multiaddr;
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+
+    if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+        perror("IP_ADD_MEMBERSHIP");
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+    /* frame reconstruction */
+
+static int put_segment(unsigned char *p, int marker, int len) {
+    p[0] = 0xFF;
+    p[1] = marker;
+    p[2] = (len + 2) >> 8;
+    p[3] = len + 2;
+
+    return 4;
+}
+
+static int put_huffman_table(unsigned char *p, int table_class, int id, const unsigned char *table) {
+    int len = jpeg_huffman_table_len(table);
+    int offs = put_segment(p, JPEG_MARKER_DHT, 1 + len);
+
+    p[offs++] = table_class << 4 | id;
+    memcpy(p + offs, table, len);
+
+    return offs + len;
+}
+
+static int make_headers(unsigned char *p) {
+    int offs = 0, i;
+
+    /* as in RFC 2435, appendix A: luma uses table 0, chroma table 1;
+     * the components are numbered from 0 */
+    p[offs++] = 0xFF;
+    p[offs++] = JPEG_MARKER_SOI;
+
+    offs += put_segment(p + offs, JPEG_MARKER_DQT, 2 * 65);
+    for (i = 0; i < 2; i++) {
+        p[offs++] = i;
+        memcpy(p + offs, frame.qtables + 64 * i, 64);
+        offs += 64;
+    }
+
+    if (frame.restart_interval) {
+        offs += put_segment(p + offs, JPEG_MARKER_DRI, 2);
+        p[offs++] = frame.restart_interval >> 8;
+        p[offs++] = frame.restart_interval;
+    }
+
+    offs += put_segment(p + offs, JPEG_MARKER_SOF0, 15);
+    p[offs++] = 8;
+    p[offs++] = frame.height >> 8;
+    p[offs++] = frame.height;
+    p[offs++] = frame.width >> 8;
+    p[offs++] = frame.width;
+    p[offs++] = 3;
+    for (i = 0; i < 3; i++) {
+        p[offs++] = i;
+        p[offs++] = i ? 0x11 : (frame.type ? 0x22 : 0x21);
+        p[offs++] = i ? 1 : 0;
+    }
+
+    offs += put_huffman_table(p + offs, 0, 0, jpeg_std_dc_luminance);
+    offs += put_huffman_table(p + offs, 1, 0, jpeg_std_ac_luminance);
+    offs += put_huffman_table(p + offs, 0, 1, jpeg_std_dc_chrominance);
+    offs += put_huffman_table(p + offs, 1, 1, jpeg_std_ac_chrominance);
+
+    offs += put_segment(p + offs, JPEG_MARKER_SOS, 10);
+    p[offs++] = 3;
+    for (i = 0; i < 3; i++) {
+        p[offs++] = i;
+        p[offs++] = i ? 0x11 : 0x00;
+    }
+    p[offs++] = 0;
+    p[offs++] = 63;
+    p[offs++] = 0;
+
+    return offs;
+}
+
+static reference_t *find_reference(jpeg_info_t *info, unsigned char *buf) {
+    int i;
+
+    for (i = 0; i < num_references; i++) {
+        if (references[i].info.scan_len == info->scan_len &&
+            !memcmp(references[i].data + references[i].info.scan_offset, buf + info->scan_offset, info->scan_len)) {
+
+            return &references[i];
+        }
+    }
+
+    return NULL;
+}
+
+static const char *compare(jpeg_info_t *info, reference_t *ref) {
+    jpeg_info_t *r = &ref->info;
+    int i;
+
+    if (info->width != r->width || info->height != r->height) {
+        return "dimensions differ";
+    }
+
+    for (i = 0; i < 3; i++) {
+        if (info->h_samp[i] != r->h_samp[i] || info->v_samp[i] != r->v_samp[i]) {
+            return "sampling differs";
+        }
+        if (memcmp(info->qtables[info->tq[i]], r->qtables[r->tq[i]], 64)) {
+            return "quantization tables differ";
+        }
+    }
+
+    if (info->restart_interval != r->restart_interval) {
+        return "restart interval differs";
+    }
+    if (!r->std_huffman) {
+        return "reference uses non-standard huffman tables";
+    }
+
+    return NULL;
+}
+
+static int finish_frame() {
+    unsigned char headers[MAX_HEADERS_LEN];
+    unsigned char *buf;
+    jpeg_info_t info;
+    reference_t *ref;
+    const char *error;
+    int headers_len, len;
+
+    /* the headers go right before the data, which leaves room for them */
+    headers_len = make_headers(headers);
+    buf = frame.data - headers_len;
+    memcpy(buf, headers, headers_len);
+    len = headers_len + frame.len;
+    buf[len++] = 0xFF;
+    buf[len++] = JPEG_MARKER_EOI;
+
+    if (output && fwrite(buf, 1, len, output) != len) {
+        perror("fwrite");
+        return -1;
+    }
+
+    printf("frame %u: %dx%d, type %d, %d packets, %d bytes", frame.timestamp,
+            frame.width, frame.height, frame.type, frame.num_packets, len);
+    if (frame.restart_interval) {
+        printf(", restart interval %d", frame.restart_interval);
+    }
+
+    if (jpeg_parse(buf, len, &info) < 0) {
+        printf(", invalid jpeg\n");
+        frames_bad++;
+        return 0;
+    }
+
+    if (!num_references) {
+        printf("\n");
+        frames_ok++;
+        return 0;
+    }
+
+    ref = find_reference(&info, buf);
+    if (!ref) {
+        printf(", no reference with the same data\n");
+        frames_bad++;
+    }
+    else if ((error = compare(&info, ref))) {
+        printf(", %s: %s\n", ref->path, error);
+        frames_bad++;
+    }
+    else {
+        printf(", matches %s\n", ref->path);
+        frames_ok++;
+    }
+
+    return 0;
+}
+
+/* returns 1 when a frame was completed, 0 otherwise and -1 on error */
+static int handle_packet(unsigned char *p, int len) {
+    uint16_t seq;
+    uint32_t timestamp;
+    int marker, header_len, offs, type, q, qtables_len;
+
+    if (len < RTP_HEADER_LEN || (p[0] >> 6) != 2 || (p[1] & 0x7F) != RTP_PAYLOAD_TYPE_JPEG) {
+        return 0;
+    }
+
+    marker = p[1] >> 7;
+    seq = p[2] << 8 | p[3];
+    timestamp = p[4] << 24 | p[5] << 16 | p[6] << 8 | p[7];
+
+    header_len = RTP_HEADER_LEN + 4 * (p[0] & 0x0F); /* CSRCs */
+    if (p[0] & 0x10) { /* extension */
+        if (len < header_len + 4) {
+            return 0;
+        }
+        header_len += 4 + 4 * (p[header_len + 2] << 8 | p[header_len + 3]);
+    }
+    if (p[0] & 0x20) { /* padding */
+        len -= p[len - 1];
+    }
+
+    p += header_len;
+    len -= header_len;
+    if (len < 8) {
+        return 0;
+    }
+
+    offs = p[1] << 16 | p[2] << 8 | p[3];
+    type = p[4];
+    q = p[5];
+
+    if (!frame.started || timestamp != frame.timestamp) {
+        if (frame.started) {
+            frames_broken++; /* the last packet of the previous frame was lost */
+        }
+
+        frame.started = 1;
+        frame.timestamp = timestamp;
+        frame.broken = offs != 0;
+        frame.len = 0;
+        frame.num_packets = 0;
+    }
+    else if (seq != frame.next_seq) {
+        frame.broken = 1;
+    }
+
+    frame.next_seq = seq + 1;
+    if (frame.broken) {
+        if (marker) {
+            frames_broken++;
+            frame.started = 0;
+        }
+
+        return 0;
+    }
+
+    if ((type & 63) > 1 || q < 128) {
+        fprintf(stderr, "unsupported rtp/jpeg type %d or q %d\n", type, q);
+        return -1;
+    }
+
+    frame.type = type & 63;
+    frame.width = p[6] * 8;
+    frame.height = p[7] * 8;
+    p += 8;
+    len -= 8;
+
+    frame.restart_interval = 0;
+    if (type >= 64) {
+        if (len < 4) {
+            frame.broken = 1;
+            return 0;
+        }
+
+        frame.restart_interval = p[0] << 8 | p[1];
+        p += 4;
+        len -= 4;
+    }
+
+    if (offs == 0) {
+        if (len < 4) {
+            frame.broken = 1;
+            return 0;
+        }
+
+        qtables_len = p[2] << 8 | p[3];
+        if (p[1] || (qtables_len && qtables_len != 128) || len < 4 + qtables_len) {
+            fprintf(stderr, "unsupported quantization tables (precision %d, length %d)\n", p[1], qtables_len);
+            return -1;
+        }
+
+        /* a null length means the tables sent earlier with the same Q */
+        if (qtables_len) {
+            memcpy(qtable_cache[q], p + 4, 128);
+            qtable_cached[q] = 1;
+        }
+        else if (!qtable_cached[q]) {
+            frame.broken = 1;
+            return 0;
+        }
+
+        memcpy(frame.qtables, qtable_cache[q], 128);
+        p += 4 + qtables_len;
+        len -= 4 + qtables_len;
+    }
+
+    if (offs != frame.len || frame.len + len > MAX_FRAME_LEN) {
+        frame.broken = 1;
+        return 0;
+    }
+
+    memcpy(frame.data + frame.len, p, len);
+    frame.len += len;
+    frame.num_packets++;
+
+    if (!marker) {
+        return 0;
+    }
+
+    frame.started = 0;
+    if (finish_frame() < 0) {
+        return -1;
+    }
+
+    return 1;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: rtp_receiver [-n frames] [-o file] [-t timeout] <group:port[:if]> [reference.jpg...]\n");
+    fprintf(stderr, "    -n frames          exit after receiving this many complete frames\n");
+    fprintf(stderr, "    -o file            write the rebuilt frames to a file, one after the other\n");
+    fprintf(stderr, "    -t timeout         give up after this many seconds without any packet\n");
+    fprintf(stderr, "                       (defaults to %d)\n", DEF_TIMEOUT);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned char *packet;
+    struct pollfd pfd;
+    int max_frames = 0, timeout = DEF_TIMEOUT, fd, len, r, c, i;
+
+    while ((c = getopt(argc, argv, "n:o:t:h")) != -1) {
+        switch (c) {
+            case 'n':
+                max_frames = strtol(optarg, NULL, 10);
+                break;
+
+            case 'o':
+                output = fopen(optarg, "wb");
+                if (!output) {
+                    perror(optarg);
+                    return 1;
+                }
+                break;
+
+            case 't':
+                timeout = strtol(optarg, NULL, 10);
+                if (timeout <= 0) {
+                    fprintf(stderr, "invalid timeout: %s\n", optarg);
+                    return 1;
+                }
+                break;
+
+            default:
+                usage();
+                return c == 'h' ? 0 : 1;
+        }
+    }
+
+    if (argc - optind < 1) {
+        usage();
+        return 1;
+    }
+
+    num_references = argc - optind - 1;
+    references = calloc(num_references, sizeof(reference_t));
+    for (i = 0; i < num_references; i++) {
+        if (load_reference(argv[optind + 1 + i], &references[i]) < 0) {
+            return 1;
+        }
+    }
+
+    fd = open_socket(argv[optind]);
+    if (fd < 0) {
+        return 1;
+    }
+
+    packet = malloc(MAX_PACKET_LEN);
+    frame.data = malloc(MAX_HEADERS_LEN + MAX_FRAME_LEN + 2);
+    frame.data += MAX_HEADERS_LEN;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    while (!max_frames || frames_ok + frames_bad < max_frames) {
+        r = poll(&pfd, 1, timeout * 1000);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            perror("poll");
+            break;
+        }
+        else if (r == 0) {
+            fprintf(stderr, "timeout waiting for frames\n");
+            break;
+        }
+
+        len = recv(fd, packet, MAX_PACKET_LEN, 0);
+        if (len < 0) {
+            perror("recv");
+            break;
+        }
+
+        if (handle_packet(packet, len) < 0) {
+            break;
+        }
+    }
+
+    if (output) {
+        fclose(output);
+    }
+
+    printf("%d frames matching, %d frames not matching, %d incomplete frames\n",
+            frames_ok, frames_bad, frames_broken);
+
+    return frames_bad || !frames_ok || (max_frames && frames_ok < max_frames) ? 1 : 0;
+}
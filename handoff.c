@@ -0,0 +1,362 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <arpa/inet.h>
+
+#include "streameye.h"
+#include "common.h"
+#include "handoff.h"
+
+
+/* the hand-off protocol consists of a header message carrying the listening
+ * and input file descriptors, followed by one message per client, carrying its
+ * socket and its stream state, followed by the pending (incomplete frame) input data */
+
+typedef struct {
+    unsigned int    magic;
+    unsigned int    version;
+    int             num_clients;
+    int             pending_len;
+    unsigned int    jpeg_seq;
+} handoff_header_t;
+
+typedef struct {
+    char            addr[INET_ADDRSTRLEN];
+    int             port;
+    char            method[10];
+    char            http_ver[10];
+    char            uri[1024];
+
+    double          frame_int;
+    double          rate;
+    int             live;
+    double          interval;
+
+    int             priority;
+
+    int             websocket;
+    unsigned int    ws_unacked_seq[WS_MAX_UNACKED_LIMIT];
+    int             ws_unacked;
+    char            ws_rbuf[WS_RBUF_LEN];
+    int             ws_rbuf_len;
+} handoff_client_t;
+
+
+    /* local functions */
+
+static int          send_with_fds(int sock, void *data, int len, int *fds, int num_fds);
+static int          recv_with_fds(int sock, void *data, int len, int *fds, int num_fds);
+static int          send_all(int sock, char *data, int len);
+static int          recv_all(int sock, char *data, int len);
+
+
+int send_with_fds(int sock, void *data, int len, int *fds, int num_fds) {
+    struct msghdr msg;
+    struct iovec iov;
+    char cmsg_buf[CMSG_SPACE(sizeof(int) * 2)];
+    struct cmsghdr *cmsg;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = data;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsg_buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * num_fds);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * num_fds);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * num_fds);
+
+    if (sendmsg(sock, &msg, 0) != len) {
+        ERRNO("hand-off: sendmsg() failed");
+        return -1;
+    }
+
+    return 0;
+}
+
+int recv_with_fds(int sock, void *data, int len, int *fds, int num_fds) {
+    struct msghdr msg;
+    struct iovec iov;
+    char cmsg_buf[CMSG_SPACE(sizeof(int) * 2)];
+    struct cmsghdr *cmsg;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = data;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsg_buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * num_fds);
+
+    /* each message is sent with a single sendmsg() on a stream socket,
+     * with the file descriptors attached to its first byte */
+    int size = recvmsg(sock, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+    if (size != len) {
+        if (size < 0) {
+            ERRNO("hand-off: recvmsg() failed");
+        }
+        else {
+            ERROR("hand-off: short message");
+        }
+
+        return -1;
+    }
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(int) * num_fds)) {
+        ERROR("hand-off: missing file descriptors");
+        return -1;
+    }
+
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * num_fds);
+
+    return 0;
+}
+
+int send_all(int sock, char *data, int len) {
+    int size;
+
+    while (len > 0) {
+        size = write(sock, data, len);
+        if (size < 0) {
+            ERRNO("hand-off: write() failed");
+            return -1;
+        }
+
+        data += size;
+        len -= size;
+    }
+
+    return 0;
+}
+
+int recv_all(int sock, char *data, int len) {
+    int size;
+
+    while (len > 0) {
+        size = read(sock, data, len);
+        if (size <= 0) {
+            if (size < 0) {
+                ERRNO("hand-off: read() failed");
+            }
+            else {
+                ERROR("hand-off: connection closed");
+            }
+
+            return -1;
+        }
+
+        data += size;
+        len -= size;
+    }
+
+    return 0;
+}
+
+
+    /* old instance */
+
+int handoff_spawn(char *argv[]) {
+    int fds[2];
+    char fd_str[16];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+        ERRNO("hand-off: socketpair() failed");
+        return -1;
+    }
+
+    struct timeval tv = {HANDOFF_TIMEOUT, 0};
+    setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, (char *) &tv, sizeof(struct timeval));
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDTIMEO, (char *) &tv, sizeof(struct timeval));
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        ERRNO("hand-off: fork() failed");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    if (pid == 0) { /* child */
+        /* only the hand-off socket is inherited by the new instance,
+         * everything else is explicitly passed to it */
+        fcntl(fds[1], F_SETFD, 0);
+        snprintf(fd_str, sizeof(fd_str), "%d", fds[1]);
+        setenv(HANDOFF_FD_ENV, fd_str, 1);
+
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+
+    INFO("hand-off: started new instance with pid %d", pid);
+    close(fds[1]);
+
+    return fds[0];
+}
+
+int handoff_send(int sock, int socket_fd, int input_fd, client_t **clients, int num_clients,
+        char *pending, int pending_len) {
+
+    handoff_header_t header;
+    handoff_client_t record;
+    int fds[2], i;
+
+    header.magic = HANDOFF_MAGIC;
+    header.version = HANDOFF_VERSION;
+    header.num_clients = num_clients;
+    header.pending_len = pending_len;
+    header.jpeg_seq = jpeg_seq;
+
+    fds[0] = socket_fd;
+    fds[1] = input_fd;
+    if (send_with_fds(sock, &header, sizeof(header), fds, 2) < 0) {
+        return -1;
+    }
+
+    for (i = 0; i < num_clients; i++) {
+        client_t *client = clients[i];
+
+        memset(&record, 0, sizeof(record));
+        memcpy(record.addr, client->addr, sizeof(record.addr));
+        record.port = client->port;
+        memcpy(record.method, client->method, sizeof(record.method));
+        memcpy(record.http_ver, client->http_ver, sizeof(record.http_ver));
+        memcpy(record.uri, client->uri, sizeof(record.uri));
+        record.frame_int = client->frame_int;
+        record.rate = client->rate_limiter.rate;
+        record.live = client->live;
+        record.interval = client->interval;
+        record.priority = client->priority;
+        record.websocket = client->websocket;
+        memcpy(record.ws_unacked_seq, client->ws_unacked_seq, sizeof(record.ws_unacked_seq));
+        record.ws_unacked = client->ws_unacked;
+        memcpy(record.ws_rbuf, client->ws_rbuf, sizeof(record.ws_rbuf));
+        record.ws_rbuf_len = client->ws_rbuf_len;
+
+        if (send_with_fds(sock, &record, sizeof(record), &client->stream_fd, 1) < 0) {
+            return -1;
+        }
+    }
+
+    return send_all(sock, pending, pending_len);
+}
+
+int handoff_wait_ack(int sock) {
+    char ack;
+
+    if (recv_all(sock, &ack, 1) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+    /* new instance */
+
+int handoff_receive(int sock, int *socket_fd, int *input_fd, client_t ***clients, int *num_clients,
+        char *pending, int *pending_len) {
+
+    handoff_header_t header;
+    handoff_client_t record;
+    int fds[2], i;
+
+    if (recv_with_fds(sock, &header, sizeof(header), fds, 2) < 0) {
+        return -1;
+    }
+
+    if (header.magic != HANDOFF_MAGIC || header.version != HANDOFF_VERSION) {
+        ERROR("hand-off: incompatible protocol version");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    *socket_fd = fds[0];
+    *input_fd = fds[1];
+    *clients = NULL;
+    *num_clients = 0;
+
+    for (i = 0; i < header.num_clients; i++) {
+        client_t *client = malloc(sizeof(client_t));
+        if (!client) {
+            ERROR("malloc() failed");
+            return -1;
+        }
+
+        memset(client, 0, sizeof(client_t));
+
+        if (recv_with_fds(sock, &record, sizeof(record), &client->stream_fd, 1) < 0) {
+            free(client);
+            return -1;
+        }
+
+        memcpy(client->addr, record.addr, sizeof(record.addr));
+        client->port = record.port;
+        memcpy(client->method, record.method, sizeof(record.method));
+        memcpy(client->http_ver, record.http_ver, sizeof(record.http_ver));
+        memcpy(client->uri, record.uri, sizeof(record.uri));
+        client->frame_int = record.frame_int;
+        client->rate_limiter.rate = record.rate;
+        client->live = record.live;
+        client->interval = record.interval;
+        client->priority = record.priority;
+        client->websocket = record.websocket;
+        memcpy(client->ws_unacked_seq, record.ws_unacked_seq, sizeof(record.ws_unacked_seq));
+        client->ws_unacked = record.ws_unacked;
+        memcpy(client->ws_rbuf, record.ws_rbuf, sizeof(record.ws_rbuf));
+        client->ws_rbuf_len = record.ws_rbuf_len;
+
+        *clients = realloc(*clients, sizeof(client_t *) * (*num_clients + 1));
+        (*clients)[(*num_clients)++] = client;
+    }
+
+    if (header.pending_len > JPEG_BUF_LEN) {
+        ERROR("hand-off: pending data too large");
+        return -1;
+    }
+
+    if (recv_all(sock, pending, header.pending_len) < 0) {
+        return -1;
+    }
+
+    *pending_len = header.pending_len;
+    jpeg_seq = header.jpeg_seq;
+
+    return 0;
+}
+
+int handoff_ack(int sock) {
+    char ack = 1;
+
+    return send_all(sock, &ack, 1);
+}
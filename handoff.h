@@ -0,0 +1,42 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HANDOFF_H
+#define __HANDOFF_H
+
+#include "client.h"
+
+#define HANDOFF_FD_ENV          "STREAMEYE_HANDOFF_FD"
+#define HANDOFF_MAGIC           0x53454846 /* "SEHF" */
+#define HANDOFF_VERSION         4
+#define HANDOFF_TIMEOUT         10 /* seconds */
+
+extern int                      handoff_parking;
+
+
+int                 handoff_spawn(char *argv[]);
+int                 handoff_send(int sock, int socket_fd, int input_fd, client_t **clients, int num_clients,
+                            char *pending, int pending_len);
+int                 handoff_wait_ack(int sock);
+int                 handoff_receive(int sock, int *socket_fd, int *input_fd, client_t ***clients, int *num_clients,
+                            char *pending, int *pending_len);
+int                 handoff_ack(int sock);
+
+
+#endif /* __HANDOFF_H */
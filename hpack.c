@@ -0,0 +1,538 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "hpack.h"
+
+
+/* header compression for HTTP/2 (RFC 7541). Request headers are decoded in full, keeping the
+ * dynamic table in sync with the client's encoder; response headers are few and small, so they're
+ * encoded as plain literals that never touch the dynamic table, which is why ours stays empty. */
+
+
+#define STATIC_TABLE_LEN        61
+#define MAX_CODE_LEN            30
+
+
+typedef struct {
+    const char *    name;
+    const char *    value;
+} static_entry_t;
+
+typedef struct {
+    unsigned int    code;
+    int             len;
+} huffman_code_t;
+
+
+static const static_entry_t static_table[STATIC_TABLE_LEN] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+static const huffman_code_t huffman_codes[256] = {
+    {0x00001ff8, 13}, {0x007fffd8, 23}, {0x0fffffe2, 28}, {0x0fffffe3, 28},
+    {0x0fffffe4, 28}, {0x0fffffe5, 28}, {0x0fffffe6, 28}, {0x0fffffe7, 28},
+    {0x0fffffe8, 28}, {0x00ffffea, 24}, {0x3ffffffc, 30}, {0x0fffffe9, 28},
+    {0x0fffffea, 28}, {0x3ffffffd, 30}, {0x0fffffeb, 28}, {0x0fffffec, 28},
+    {0x0fffffed, 28}, {0x0fffffee, 28}, {0x0fffffef, 28}, {0x0ffffff0, 28},
+    {0x0ffffff1, 28}, {0x0ffffff2, 28}, {0x3ffffffe, 30}, {0x0ffffff3, 28},
+    {0x0ffffff4, 28}, {0x0ffffff5, 28}, {0x0ffffff6, 28}, {0x0ffffff7, 28},
+    {0x0ffffff8, 28}, {0x0ffffff9, 28}, {0x0ffffffa, 28}, {0x0ffffffb, 28},
+    {0x00000014,  6}, {0x000003f8, 10}, {0x000003f9, 10}, {0x00000ffa, 12},
+    {0x00001ff9, 13}, {0x00000015,  6}, {0x000000f8,  8}, {0x000007fa, 11},
+    {0x000003fa, 10}, {0x000003fb, 10}, {0x000000f9,  8}, {0x000007fb, 11},
+    {0x000000fa,  8}, {0x00000016,  6}, {0x00000017,  6}, {0x00000018,  6},
+    {0x00000000,  5}, {0x00000001,  5}, {0x00000002,  5}, {0x00000019,  6},
+    {0x0000001a,  6}, {0x0000001b,  6}, {0x0000001c,  6}, {0x0000001d,  6},
+    {0x0000001e,  6}, {0x0000001f,  6}, {0x0000005c,  7}, {0x000000fb,  8},
+    {0x00007ffc, 15}, {0x00000020,  6}, {0x00000ffb, 12}, {0x000003fc, 10},
+    {0x00001ffa, 13}, {0x00000021,  6}, {0x0000005d,  7}, {0x0000005e,  7},
+    {0x0000005f,  7}, {0x00000060,  7}, {0x00000061,  7}, {0x00000062,  7},
+    {0x00000063,  7}, {0x00000064,  7}, {0x00000065,  7}, {0x00000066,  7},
+    {0x00000067,  7}, {0x00000068,  7}, {0x00000069,  7}, {0x0000006a,  7},
+    {0x0000006b,  7}, {0x0000006c,  7}, {0x0000006d,  7}, {0x0000006e,  7},
+    {0x0000006f,  7}, {0x00000070,  7}, {0x00000071,  7}, {0x00000072,  7},
+    {0x000000fc,  8}, {0x00000073,  7}, {0x000000fd,  8}, {0x00001ffb, 13},
+    {0x0007fff0, 19}, {0x00001ffc, 13}, {0x00003ffc, 14}, {0x00000022,  6},
+    {0x00007ffd, 15}, {0x00000003,  5}, {0x00000023,  6}, {0x00000004,  5},
+    {0x00000024,  6}, {0x00000005,  5}, {0x00000025,  6}, {0x00000026,  6},
+    {0x00000027,  6}, {0x00000006,  5}, {0x00000074,  7}, {0x00000075,  7},
+    {0x00000028,  6}, {0x00000029,  6}, {0x0000002a,  6}, {0x00000007,  5},
+    {0x0000002b,  6}, {0x00000076,  7}, {0x0000002c,  6}, {0x00000008,  5},
+    {0x00000009,  5}, {0x0000002d,  6}, {0x00000077,  7}, {0x00000078,  7},
+    {0x00000079,  7}, {0x0000007a,  7}, {0x0000007b,  7}, {0x00007ffe, 15},
+    {0x000007fc, 11}, {0x00003ffd, 14}, {0x00001ffd, 13}, {0x0ffffffc, 28},
+    {0x000fffe6, 20}, {0x003fffd2, 22}, {0x000fffe7, 20}, {0x000fffe8, 20},
+    {0x003fffd3, 22}, {0x003fffd4, 22}, {0x003fffd5, 22}, {0x007fffd9, 23},
+    {0x003fffd6, 22}, {0x007fffda, 23}, {0x007fffdb, 23}, {0x007fffdc, 23},
+    {0x007fffdd, 23}, {0x007fffde, 23}, {0x00ffffeb, 24}, {0x007fffdf, 23},
+    {0x00ffffec, 24}, {0x00ffffed, 24}, {0x003fffd7, 22}, {0x007fffe0, 23},
+    {0x00ffffee, 24}, {0x007fffe1, 23}, {0x007fffe2, 23}, {0x007fffe3, 23},
+    {0x007fffe4, 23}, {0x001fffdc, 21}, {0x003fffd8, 22}, {0x007fffe5, 23},
+    {0x003fffd9, 22}, {0x007fffe6, 23}, {0x007fffe7, 23}, {0x00ffffef, 24},
+    {0x003fffda, 22}, {0x001fffdd, 21}, {0x000fffe9, 20}, {0x003fffdb, 22},
+    {0x003fffdc, 22}, {0x007fffe8, 23}, {0x007fffe9, 23}, {0x001fffde, 21},
+    {0x007fffea, 23}, {0x003fffdd, 22}, {0x003fffde, 22}, {0x00fffff0, 24},
+    {0x001fffdf, 21}, {0x003fffdf, 22}, {0x007fffeb, 23}, {0x007fffec, 23},
+    {0x001fffe0, 21}, {0x001fffe1, 21}, {0x003fffe0, 22}, {0x001fffe2, 21},
+    {0x007fffed, 23}, {0x003fffe1, 22}, {0x007fffee, 23}, {0x007fffef, 23},
+    {0x000fffea, 20}, {0x003fffe2, 22}, {0x003fffe3, 22}, {0x003fffe4, 22},
+    {0x007ffff0, 23}, {0x003fffe5, 22}, {0x003fffe6, 22}, {0x007ffff1, 23},
+    {0x03ffffe0, 26}, {0x03ffffe1, 26}, {0x000fffeb, 20}, {0x0007fff1, 19},
+    {0x003fffe7, 22}, {0x007ffff2, 23}, {0x003fffe8, 22}, {0x01ffffec, 25},
+    {0x03ffffe2, 26}, {0x03ffffe3, 26}, {0x03ffffe4, 26}, {0x07ffffde, 27},
+    {0x07ffffdf, 27}, {0x03ffffe5, 26}, {0x00fffff1, 24}, {0x01ffffed, 25},
+    {0x0007fff2, 19}, {0x001fffe3, 21}, {0x03ffffe6, 26}, {0x07ffffe0, 27},
+    {0x07ffffe1, 27}, {0x03ffffe7, 26}, {0x07ffffe2, 27}, {0x00fffff2, 24},
+    {0x001fffe4, 21}, {0x001fffe5, 21}, {0x03ffffe8, 26}, {0x03ffffe9, 26},
+    {0x0ffffffd, 28}, {0x07ffffe3, 27}, {0x07ffffe4, 27}, {0x07ffffe5, 27},
+    {0x000fffec, 20}, {0x00fffff3, 24}, {0x000fffed, 20}, {0x001fffe6, 21},
+    {0x003fffe9, 22}, {0x001fffe7, 21}, {0x001fffe8, 21}, {0x007ffff3, 23},
+    {0x003fffea, 22}, {0x003fffeb, 22}, {0x01ffffee, 25}, {0x01ffffef, 25},
+    {0x00fffff4, 24}, {0x00fffff5, 24}, {0x03ffffea, 26}, {0x007ffff4, 23},
+    {0x03ffffeb, 26}, {0x07ffffe6, 27}, {0x03ffffec, 26}, {0x03ffffed, 26},
+    {0x07ffffe7, 27}, {0x07ffffe8, 27}, {0x07ffffe9, 27}, {0x07ffffea, 27},
+    {0x07ffffeb, 27}, {0x0ffffffe, 28}, {0x07ffffec, 27}, {0x07ffffed, 27},
+    {0x07ffffee, 27}, {0x07ffffef, 27}, {0x07fffff0, 27}, {0x03ffffee, 26},
+};
+
+
+    /* locals */
+
+static pthread_once_t huffman_once = PTHREAD_ONCE_INIT;
+
+/* the code is canonical: the codes of each length are consecutive, and so are their symbols, once sorted */
+static unsigned int first_code[MAX_CODE_LEN + 1];
+static int num_codes[MAX_CODE_LEN + 1];
+static int sym_offs[MAX_CODE_LEN + 1];
+static unsigned char symbols[256];
+
+
+    /* local functions */
+
+static void         init_huffman();
+static int          huffman_decode(const unsigned char *buf, int len, char *out);
+static int          decode_int(const unsigned char **p, const unsigned char *end, int prefix_bits, unsigned int *value);
+static char *       decode_string(const unsigned char **p, const unsigned char *end);
+static int          encode_int(unsigned char *buf, int prefix_bits, unsigned int value);
+static int          encode_string(unsigned char *buf, const char *str);
+static int          lookup(hpack_decoder_t *dec, unsigned int index, const char **name, const char **value);
+static void         evict(hpack_decoder_t *dec, int size);
+static void         add_entry(hpack_decoder_t *dec, char *name, char *value);
+
+
+    /* huffman coding */
+
+void init_huffman() {
+    int len, sym, k = 0;
+
+    for (len = 1; len <= MAX_CODE_LEN; len++) {
+        sym_offs[len] = k;
+        for (sym = 0; sym < 256; sym++) {
+            if (huffman_codes[sym].len != len) {
+                continue;
+            }
+
+            if (!num_codes[len]) {
+                first_code[len] = huffman_codes[sym].code;
+            }
+            num_codes[len]++;
+            symbols[k++] = sym;
+        }
+    }
+}
+
+int huffman_decode(const unsigned char *buf, int len, char *out) {
+    unsigned int code = 0;
+    int i, bit, code_len = 0, out_len = 0;
+
+    pthread_once(&huffman_once, init_huffman);
+
+    for (i = 0; i < len; i++) {
+        for (bit = 7; bit >= 0; bit--) {
+            code = code << 1 | ((buf[i] >> bit) & 1);
+            code_len++;
+
+            if (num_codes[code_len] && code - first_code[code_len] < (unsigned int) num_codes[code_len]) {
+                out[out_len++] = symbols[sym_offs[code_len] + code - first_code[code_len]];
+                code = 0;
+                code_len = 0;
+            }
+            else if (code_len >= MAX_CODE_LEN) {
+                return -1; /* the end of string symbol, or garbage */
+            }
+        }
+    }
+
+    /* the last symbol is padded with the most significant bits of EOS (all ones), at most 7 of them */
+    if (code_len > 7 || code != (1U << code_len) - 1) {
+        return -1;
+    }
+
+    return out_len;
+}
+
+
+    /* primitives */
+
+int decode_int(const unsigned char **p, const unsigned char *end, int prefix_bits, unsigned int *value) {
+    unsigned int mask = (1 << prefix_bits) - 1;
+    int shift = 0;
+    unsigned char b;
+
+    if (*p >= end) {
+        return -1;
+    }
+
+    *value = *(*p)++ & mask;
+    if (*value < mask) {
+        return 0;
+    }
+
+    do {
+        if (*p >= end || shift > 21) {
+            return -1;
+        }
+
+        b = *(*p)++;
+        *value += (b & 0x7F) << shift;
+        shift += 7;
+    } while (b & 0x80);
+
+    return 0;
+}
+
+char *decode_string(const unsigned char **p, const unsigned char *end) {
+    unsigned int len;
+    int huffman, out_len;
+    char *str;
+
+    if (*p >= end) {
+        return NULL;
+    }
+
+    huffman = **p & 0x80;
+    if (decode_int(p, end, 7, &len) < 0 || len > end - *p || len > HPACK_MAX_STRING_LEN) {
+        return NULL;
+    }
+
+    if (huffman) {
+        /* the shortest code is 5 bits long */
+        str = malloc(len * 8 / 5 + 1);
+        out_len = huffman_decode(*p, len, str);
+        if (out_len < 0) {
+            free(str);
+            return NULL;
+        }
+    }
+    else {
+        str = malloc(len + 1);
+        memcpy(str, *p, len);
+        out_len = len;
+    }
+
+    str[out_len] = 0;
+    *p += len;
+
+    return str;
+}
+
+int encode_int(unsigned char *buf, int prefix_bits, unsigned int value) {
+    unsigned int mask = (1 << prefix_bits) - 1;
+    int len = 1;
+
+    /* the bits above the prefix are left to the caller */
+    if (value < mask) {
+        buf[0] |= value;
+        return 1;
+    }
+
+    buf[0] |= mask;
+    value -= mask;
+    while (value >= 0x80) {
+        buf[len++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    buf[len++] = value;
+
+    return len;
+}
+
+int encode_string(unsigned char *buf, const char *str) {
+    int len = strlen(str), offs;
+
+    buf[0] = 0; /* not huffman coded */
+    offs = encode_int(buf, 7, len);
+    memcpy(buf + offs, str, len);
+
+    return offs + len;
+}
+
+
+    /* tables */
+
+int lookup(hpack_decoder_t *dec, unsigned int index, const char **name, const char **value) {
+    hpack_entry_t *entry;
+
+    if (index == 0) {
+        return -1;
+    }
+
+    if (index <= STATIC_TABLE_LEN) {
+        *name = static_table[index - 1].name;
+        *value = static_table[index - 1].value;
+
+        return 0;
+    }
+
+    index -= STATIC_TABLE_LEN + 1;
+    if (index >= dec->num_entries) {
+        return -1;
+    }
+
+    /* the dynamic table is indexed from the newest entry */
+    entry = &dec->entries[dec->num_entries - 1 - index];
+    *name = entry->name;
+    *value = entry->value;
+
+    return 0;
+}
+
+void evict(hpack_decoder_t *dec, int size) {
+    int i = 0;
+
+    /* makes room for an entry of the given size, dropping the oldest ones */
+    while (i < dec->num_entries && dec->size + size > dec->max_size) {
+        dec->size -= dec->entries[i].size;
+        free(dec->entries[i].name);
+        free(dec->entries[i].value);
+        i++;
+    }
+
+    if (i) {
+        dec->num_entries -= i;
+        memmove(dec->entries, dec->entries + i, sizeof(hpack_entry_t) * dec->num_entries);
+    }
+}
+
+void add_entry(hpack_decoder_t *dec, char *name, char *value) {
+    int size = strlen(name) + strlen(value) + 32;
+
+    evict(dec, size);
+
+    if (dec->size + size > dec->max_size) {
+        /* larger than the whole table, which is now empty */
+        free(name);
+        free(value);
+        return;
+    }
+
+    if (dec->num_entries >= dec->max_entries) {
+        dec->max_entries = MAX(16, 2 * dec->max_entries);
+        dec->entries = realloc(dec->entries, sizeof(hpack_entry_t) * dec->max_entries);
+    }
+
+    dec->entries[dec->num_entries].name = name;
+    dec->entries[dec->num_entries].value = value;
+    dec->entries[dec->num_entries].size = size;
+    dec->num_entries++;
+    dec->size += size;
+}
+
+
+    /* decoding */
+
+void hpack_decoder_init(hpack_decoder_t *dec, int limit) {
+    memset(dec, 0, sizeof(hpack_decoder_t));
+    dec->max_size = limit;
+    dec->limit = limit;
+}
+
+void hpack_decoder_free(hpack_decoder_t *dec) {
+    dec->max_size = 0;
+    evict(dec, 0);
+    free(dec->entries);
+    dec->entries = NULL;
+    dec->max_entries = 0;
+}
+
+int hpack_decode(hpack_decoder_t *dec, const unsigned char *buf, int len, hpack_header_func_t func, void *arg) {
+    const unsigned char *p = buf, *end = buf + len;
+    const char *name, *value;
+    char *new_name, *new_value;
+    unsigned int index;
+    int prefix_bits, indexing;
+
+    while (p < end) {
+        if (*p & 0x80) {
+            /* indexed header field */
+            if (decode_int(&p, end, 7, &index) < 0 || lookup(dec, index, &name, &value) < 0) {
+                return -1;
+            }
+
+            func(arg, name, value);
+            continue;
+        }
+
+        if ((*p & 0xE0) == 0x20) {
+            /* dynamic table size update */
+            if (decode_int(&p, end, 5, &index) < 0 || index > dec->limit) {
+                return -1;
+            }
+
+            dec->max_size = index;
+            evict(dec, 0);
+            continue;
+        }
+
+        /* a literal, with incremental indexing, without indexing or never indexed */
+        indexing = (*p & 0xC0) == 0x40;
+        prefix_bits = indexing ? 6 : 4;
+        if (decode_int(&p, end, prefix_bits, &index) < 0) {
+            return -1;
+        }
+
+        if (index) {
+            if (lookup(dec, index, &name, &value) < 0) {
+                return -1;
+            }
+            new_name = strdup(name);
+        }
+        else {
+            new_name = decode_string(&p, end);
+            if (!new_name) {
+                return -1;
+            }
+        }
+
+        new_value = decode_string(&p, end);
+        if (!new_value) {
+            free(new_name);
+            return -1;
+        }
+
+        func(arg, new_name, new_value);
+
+        if (indexing) {
+            add_entry(dec, new_name, new_value);
+        }
+        else {
+            free(new_name);
+            free(new_value);
+        }
+    }
+
+    return 0;
+}
+
+
+    /* encoding */
+
+int hpack_encode_status(unsigned char *buf, int status) {
+    char value[8];
+
+    if (status == 200) {
+        buf[0] = 0x80 | 8; /* indexed, from the static table */
+        return 1;
+    }
+
+    /* a literal without indexing, named after the static ":status" entry */
+    snprintf(value, sizeof(value), "%d", status);
+    buf[0] = 0x00;
+    encode_int(buf, 4, 8);
+
+    return 1 + encode_string(buf + 1, value);
+}
+
+int hpack_encode_header(unsigned char *buf, const char *name, const char *value) {
+    int len = 1;
+
+    /* a literal without indexing, with a literal name; the buffer must hold
+     * the name and the value, plus a few bytes for their lengths */
+    buf[0] = 0x00;
+    len += encode_string(buf + len, name);
+    len += encode_string(buf + len, value);
+
+    return len;
+}
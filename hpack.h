@@ -0,0 +1,52 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HPACK_H
+#define __HPACK_H
+
+#define HPACK_DEF_TABLE_SIZE    4096
+#define HPACK_MAX_STRING_LEN    8192
+
+typedef struct {
+    char *          name;
+    char *          value;
+    int             size; /* as accounted by the spec, 32 bytes more than the name and value */
+} hpack_entry_t;
+
+typedef struct {
+    hpack_entry_t * entries; /* the oldest first */
+    int             num_entries;
+    int             max_entries;
+    int             size;
+    int             max_size; /* as last set by the encoder */
+    int             limit; /* the size the encoder was allowed, through our settings */
+} hpack_decoder_t;
+
+typedef void (*hpack_header_func_t)(void *arg, const char *name, const char *value);
+
+
+void                hpack_decoder_init(hpack_decoder_t *dec, int limit);
+void                hpack_decoder_free(hpack_decoder_t *dec);
+int                 hpack_decode(hpack_decoder_t *dec, const unsigned char *buf, int len,
+                            hpack_header_func_t func, void *arg);
+int                 hpack_encode_status(unsigned char *buf, int status);
+int                 hpack_encode_header(unsigned char *buf, const char *name, const char *value);
+
+
+#endif /* __HPACK_H */
@@ -0,0 +1,1102 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+
+#include "streameye.h"
+#include "common.h"
+#include "auth.h"
+#include "handoff.h"
+#include "metrics.h"
+#include "load.h"
+#include "motion.h"
+#include "ratelimit.h"
+#include "hpack.h"
+#include "http2.h"
+
+
+/* HTTP/2 over cleartext (h2c), either with prior knowledge or upgraded from HTTP/1.1, lets a
+ * single connection carry any number of streams, e.g. all the tiles of a dashboard. The connection
+ * is served by a single thread: each published frame is copied once per connection and shared by
+ * all its streams. A stream whose flow control window is exhausted keeps sending the frame it's on
+ * as the client opens the window, while newer frames are skipped for it. */
+
+
+#define FRAME_HEADER_LEN        9
+
+#define FRAME_DATA              0x0
+#define FRAME_HEADERS           0x1
+#define FRAME_PRIORITY          0x2
+#define FRAME_RST_STREAM        0x3
+#define FRAME_SETTINGS          0x4
+#define FRAME_PUSH_PROMISE      0x5
+#define FRAME_PING              0x6
+#define FRAME_GOAWAY            0x7
+#define FRAME_WINDOW_UPDATE     0x8
+#define FRAME_CONTINUATION      0x9
+
+#define FLAG_END_STREAM         0x01
+#define FLAG_ACK                0x01
+#define FLAG_END_HEADERS        0x04
+#define FLAG_PADDED             0x08
+#define FLAG_PRIORITY           0x20
+
+#define SETTINGS_HEADER_TABLE_SIZE      0x1
+#define SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define SETTINGS_INITIAL_WINDOW_SIZE    0x4
+#define SETTINGS_MAX_FRAME_SIZE         0x5
+
+#define ERR_NO_ERROR            0x0
+#define ERR_PROTOCOL_ERROR      0x1
+#define ERR_FLOW_CONTROL_ERROR  0x3
+#define ERR_FRAME_SIZE_ERROR    0x6
+#define ERR_REFUSED_STREAM      0x7
+#define ERR_COMPRESSION_ERROR   0x9
+
+#define MAX_WINDOW              0x7FFFFFFF
+#define IDLE_TIMEOUT            60 /* seconds without streams before the connection is closed */
+
+#define STREAM_MJPEG            0
+#define STREAM_SNAPSHOT         1 /* waiting for a frame, which ends the stream */
+#define STREAM_BODY             2
+
+typedef struct {
+    int             refs;
+    int             size;
+    char            data[];
+} frame_copy_t;
+
+typedef struct {
+    unsigned int    id;
+    int             type;
+    int             window;
+    int             end_stream; /* whether the stream ends with the data being sent */
+    frame_copy_t *  copy; /* the frame being sent, if any */
+    char *          body; /* or a body of our own */
+    const char *    data;
+    int             size;
+    char            header[MULTIPART_HEADER_LEN]; /* sent before the data */
+    int             header_len;
+    int             offs; /* how much of the header and the data has been sent */
+    rate_limiter_t  rate_limiter; /* at the per-client default, also enforcing the total limit */
+} stream_t;
+
+typedef struct http2_conn {
+    client_t *      client;
+    int             wake_fd;
+    unsigned char   rbuf[FRAME_HEADER_LEN + HTTP2_MAX_FRAME_SIZE];
+    int             rbuf_len;
+    int             preface_offs; /* how much of the client's connection preface was received */
+    hpack_decoder_t hpack;
+
+    unsigned char * header_block; /* being continued */
+    int             header_block_len;
+    unsigned int    header_stream; /* whose header block is being continued, 0 when none */
+    int             header_end_stream;
+
+    stream_t        streams[HTTP2_MAX_STREAMS];
+    int             num_streams;
+    unsigned int    last_stream_id;
+    double          idle_since;
+
+    int             window;
+    int             initial_window; /* for the streams, from the client's settings */
+    int             max_frame_size; /* the client's */
+
+    frame_copy_t *  latest;
+    unsigned int    latest_seq;
+} http2_conn_t;
+
+typedef struct {
+    char            method[10];
+    char            path[1024];
+    char *          auth_basic_hash;
+    int             authorized;
+} request_t;
+
+
+const char *RESPONSE_UPGRADE_HEADER =
+        "HTTP/1.1 101 Switching Protocols\r\n"
+        "Connection: Upgrade\r\n"
+        "Upgrade: h2c\r\n"
+        "\r\n";
+
+
+    /* local functions */
+
+static void         release_copy(frame_copy_t *copy);
+static int          write_frame(http2_conn_t *conn, int type, int flags, unsigned int stream_id,
+                            const void *payload, int len);
+static int          write_settings(http2_conn_t *conn);
+static int          write_goaway(http2_conn_t *conn, int error);
+static int          write_rst_stream(http2_conn_t *conn, unsigned int stream_id, int error);
+static int          write_window_update(http2_conn_t *conn, unsigned int stream_id, int increment);
+static int          write_response_headers(http2_conn_t *conn, unsigned int stream_id, int status,
+                            const char *content_type, int content_len, const char *extra_name,
+                            const char *extra_value, int end_stream);
+static stream_t *   find_stream(http2_conn_t *conn, unsigned int stream_id);
+static stream_t *   new_stream(http2_conn_t *conn, unsigned int stream_id, int type);
+static void         close_stream(http2_conn_t *conn, stream_t *stream);
+static void         start_part(http2_conn_t *conn, stream_t *stream);
+static void         take_frame(http2_conn_t *conn);
+static int          respond_body(http2_conn_t *conn, unsigned int stream_id, int status,
+                            const char *content_type, char *body, int len);
+static void         collect_header(void *arg, const char *name, const char *value);
+static int          handle_request(http2_conn_t *conn, unsigned int stream_id, request_t *req, int end_stream);
+static int          open_stream(http2_conn_t *conn);
+static int          apply_settings(http2_conn_t *conn, const unsigned char *payload, int len);
+static int          handle_frame(http2_conn_t *conn, int type, int flags, unsigned int stream_id,
+                            unsigned char *payload, int len);
+static int          read_input(http2_conn_t *conn);
+static int          flush(http2_conn_t *conn);
+static void         deliver(http2_conn_t *conn);
+static int          decode_base64url(const char *src, unsigned char *dest, int max_len);
+
+
+    /* frame copies */
+
+void release_copy(frame_copy_t *copy) {
+    if (copy && --copy->refs == 0) {
+        free(copy);
+    }
+}
+
+
+    /* output */
+
+int write_frame(http2_conn_t *conn, int type, int flags, unsigned int stream_id, const void *payload, int len) {
+    unsigned char header[FRAME_HEADER_LEN];
+
+    header[0] = len >> 16;
+    header[1] = len >> 8;
+    header[2] = len;
+    header[3] = type;
+    header[4] = flags;
+    header[5] = (stream_id >> 24) & 0x7F;
+    header[6] = stream_id >> 16;
+    header[7] = stream_id >> 8;
+    header[8] = stream_id;
+
+    struct iovec iov[2] = {
+        {header, FRAME_HEADER_LEN},
+        {(void *) payload, len}
+    };
+
+    int written = writev(conn->client->stream_fd, iov, len ? 2 : 1);
+    if (written < 0) {
+        if (errno == EPIPE || errno == EINTR) {
+            return 0;
+        }
+
+        ERRNO_CLIENT(conn->client, "writev() failed");
+        return -1;
+    }
+    else if (written < FRAME_HEADER_LEN + len) {
+        ERROR_CLIENT(conn->client, "not all data could be written");
+        return -1;
+    }
+
+    return written;
+}
+
+int write_settings(http2_conn_t *conn) {
+    unsigned char payload[6];
+
+    payload[0] = 0;
+    payload[1] = SETTINGS_MAX_CONCURRENT_STREAMS;
+    payload[2] = HTTP2_MAX_STREAMS >> 24;
+    payload[3] = HTTP2_MAX_STREAMS >> 16;
+    payload[4] = HTTP2_MAX_STREAMS >> 8;
+    payload[5] = HTTP2_MAX_STREAMS;
+
+    return write_frame(conn, FRAME_SETTINGS, 0, 0, payload, sizeof(payload));
+}
+
+int write_goaway(http2_conn_t *conn, int error) {
+    unsigned char payload[8];
+
+    payload[0] = (conn->last_stream_id >> 24) & 0x7F;
+    payload[1] = conn->last_stream_id >> 16;
+    payload[2] = conn->last_stream_id >> 8;
+    payload[3] = conn->last_stream_id;
+    payload[4] = error >> 24;
+    payload[5] = error >> 16;
+    payload[6] = error >> 8;
+    payload[7] = error;
+
+    return write_frame(conn, FRAME_GOAWAY, 0, 0, payload, sizeof(payload));
+}
+
+int write_rst_stream(http2_conn_t *conn, unsigned int stream_id, int error) {
+    unsigned char payload[4];
+
+    payload[0] = error >> 24;
+    payload[1] = error >> 16;
+    payload[2] = error >> 8;
+    payload[3] = error;
+
+    return write_frame(conn, FRAME_RST_STREAM, 0, stream_id, payload, sizeof(payload));
+}
+
+int write_window_update(http2_conn_t *conn, unsigned int stream_id, int increment) {
+    unsigned char payload[4];
+
+    payload[0] = (increment >> 24) & 0x7F;
+    payload[1] = increment >> 16;
+    payload[2] = increment >> 8;
+    payload[3] = increment;
+
+    return write_frame(conn, FRAME_WINDOW_UPDATE, 0, stream_id, payload, sizeof(payload));
+}
+
+int write_response_headers(http2_conn_t *conn, unsigned int stream_id, int status, const char *content_type,
+        int content_len, const char *extra_name, const char *extra_value, int end_stream) {
+
+    unsigned char block[1024];
+    char value[32];
+    int len;
+
+    len = hpack_encode_status(block, status);
+    len += hpack_encode_header(block + len, "server", "streamEye/" STREAM_EYE_VERSION);
+    len += hpack_encode_header(block + len, "cache-control", "no-cache, private");
+    if (content_type) {
+        len += hpack_encode_header(block + len, "content-type", content_type);
+    }
+    if (content_len >= 0) {
+        snprintf(value, sizeof(value), "%d", content_len);
+        len += hpack_encode_header(block + len, "content-length", value);
+    }
+    if (extra_name && strlen(extra_value) < sizeof(block) - len - 64) {
+        len += hpack_encode_header(block + len, extra_name, extra_value);
+    }
+
+    return write_frame(conn, FRAME_HEADERS, FLAG_END_HEADERS | (end_stream ? FLAG_END_STREAM : 0),
+            stream_id, block, len);
+}
+
+
+    /* streams */
+
+stream_t *find_stream(http2_conn_t *conn, unsigned int stream_id) {
+    int i;
+
+    for (i = 0; i < conn->num_streams; i++) {
+        if (conn->streams[i].id == stream_id) {
+            return &conn->streams[i];
+        }
+    }
+
+    return NULL;
+}
+
+stream_t *new_stream(http2_conn_t *conn, unsigned int stream_id, int type) {
+    stream_t *stream = &conn->streams[conn->num_streams++];
+
+    memset(stream, 0, sizeof(stream_t));
+    stream->id = stream_id;
+    stream->type = type;
+    stream->window = conn->initial_window;
+    rate_limiter_init(&stream->rate_limiter, get_client_rate_limit());
+
+    return stream;
+}
+
+void close_stream(http2_conn_t *conn, stream_t *stream) {
+    DEBUG_CLIENT(conn->client, "http2: stream %u closed", stream->id);
+
+    release_copy(stream->copy);
+    free(stream->body);
+
+    *stream = conn->streams[--conn->num_streams];
+    if (!conn->num_streams) {
+        conn->idle_since = get_now();
+    }
+}
+
+void start_part(http2_conn_t *conn, stream_t *stream) {
+    stream->copy = conn->latest;
+    stream->copy->refs++;
+    stream->data = stream->copy->data;
+    stream->size = stream->copy->size;
+    stream->offs = 0;
+
+    if (stream->type == STREAM_SNAPSHOT) {
+        stream->header_len = 0;
+        stream->end_stream = 1;
+    }
+    else {
+        /* the frame is taken as soon as it's published, and its motion score only comes with it
+         * if the analysis was quick enough */
+        stream->header_len = format_multipart_header(stream->header, MULTIPART_HEADER_LEN, stream->size,
+                motion_score(conn->latest_seq));
+    }
+}
+
+void take_frame(http2_conn_t *conn) {
+    /* must be called with the jpeg mutex locked */
+    frame_copy_t *copy;
+
+    if (conn->latest && conn->latest_seq == jpeg_seq) {
+        return;
+    }
+
+    /* one copy for all the streams of the connection */
+    copy = malloc(sizeof(frame_copy_t) + jpeg_size);
+    copy->refs = 1;
+    copy->size = jpeg_size;
+    memcpy(copy->data, jpeg_buf, jpeg_size);
+
+    release_copy(conn->latest);
+    conn->latest = copy;
+    conn->latest_seq = jpeg_seq;
+}
+
+void deliver(http2_conn_t *conn) {
+    stream_t *stream;
+    int i;
+
+    for (i = 0; i < conn->num_streams; i++) {
+        stream = &conn->streams[i];
+        if (stream->type == STREAM_BODY) {
+            continue;
+        }
+
+        if (stream->copy) {
+            /* still on the previous frame, for the lack of window */
+            if (stream->type == STREAM_MJPEG) {
+                DEBUG_CLIENT(conn->client, "http2: stream %u window exhausted, skipping frame %u",
+                        stream->id, conn->latest_seq);
+                conn->client->frames_skipped++;
+            }
+            continue;
+        }
+
+        if (!rate_limiter_consume(&stream->rate_limiter, conn->latest->size)) {
+            DEBUG_CLIENT(conn->client, "http2: stream %u rate limit reached, skipping frame %u",
+                    stream->id, conn->latest_seq);
+            conn->client->frames_skipped++;
+            continue;
+        }
+
+        start_part(conn, stream);
+    }
+}
+
+int respond_body(http2_conn_t *conn, unsigned int stream_id, int status, const char *content_type, char *body, int len) {
+    stream_t *stream;
+    int r;
+
+    r = write_response_headers(conn, stream_id, status, content_type, len, NULL, NULL, len == 0);
+    if (r <= 0 || len == 0) {
+        free(body);
+        return r;
+    }
+
+    stream = new_stream(conn, stream_id, STREAM_BODY);
+    stream->body = body;
+    stream->data = body;
+    stream->size = len;
+    stream->end_stream = 1;
+
+    return r;
+}
+
+
+    /* requests */
+
+void collect_header(void *arg, const char *name, const char *value) {
+    request_t *req = arg;
+
+    DEBUG("http2: header: %s: %s", name, value);
+
+    if (!strcmp(name, ":method")) {
+        snprintf(req->method, sizeof(req->method), "%s", value);
+    }
+    else if (!strcmp(name, ":path")) {
+        snprintf(req->path, sizeof(req->path), "%s", value);
+    }
+    else if (!strcmp(name, "authorization") && !strncmp(value, "Basic ", 6) && !req->auth_basic_hash) {
+        req->auth_basic_hash = strdup(value + 6);
+    }
+}
+
+int handle_request(http2_conn_t *conn, unsigned int stream_id, request_t *req, int end_stream) {
+    client_t *client = conn->client;
+    stream_t *stream;
+    char param[16], realm[256];
+    char *body;
+    int len, r;
+
+    DEBUG_CLIENT(client, "http2: stream %u: %s %s", stream_id, req->method, req->path);
+
+    if (conn->num_streams >= HTTP2_MAX_STREAMS) {
+        DEBUG_CLIENT(client, "http2: too many streams, refusing stream %u", stream_id);
+        return write_rst_stream(conn, stream_id, ERR_REFUSED_STREAM);
+    }
+
+    if (!req->authorized && get_auth_mode() == AUTH_BASIC && !auth_basic_valid(req->auth_basic_hash)) {
+        if (req->auth_basic_hash) {
+            ERROR_CLIENT(client, "http2: authentication error");
+        }
+        snprintf(realm, sizeof(realm), "Basic realm=\"%s\"", get_auth_realm());
+
+        return write_response_headers(conn, stream_id, 401, NULL, 0, "www-authenticate", realm, 1);
+    }
+
+    if (strcmp(req->method, "GET") && strcmp(req->method, "HEAD")) {
+        return write_response_headers(conn, stream_id, 405, NULL, 0, NULL, NULL, 1);
+    }
+
+    if (is_metrics_uri(req->path)) {
+        body = malloc(METRICS_BUF_LEN);
+        len = metrics_format(body);
+        if (!strcmp(req->method, "HEAD")) {
+            len = 0;
+        }
+
+        return respond_body(conn, stream_id, 200, "text/plain; version=0.0.4", body, len);
+    }
+
+    /* the priority class is the connection's, raised by the first stream to present priority credentials */
+    if (client->priority < PRIORITY_HIGH && auth_priority(req->auth_basic_hash, client->stream_fd) == PRIORITY_HIGH) {
+        DEBUG_CLIENT(client, "high priority client");
+        client->priority = PRIORITY_HIGH;
+    }
+    if (client->priority < PRIORITY_HIGH && load_shedding()) {
+        snprintf(realm, sizeof(realm), "%d", LOAD_STEP_INTERVAL * (LOAD_LEVEL_SHED + 1));
+
+        return write_response_headers(conn, stream_id, 503, NULL, 0, "retry-after", realm, 1);
+    }
+
+    if (find_uri_param(req->path, "snapshot", param, sizeof(param)) && strcmp(param, "0") && strcmp(param, "false")) {
+        if (!strcmp(req->method, "HEAD")) {
+            return write_response_headers(conn, stream_id, 200, "image/jpeg", -1, NULL, NULL, 1);
+        }
+
+        r = write_response_headers(conn, stream_id, 200, "image/jpeg", -1, NULL, NULL, 0);
+        if (r <= 0) {
+            return r;
+        }
+
+        /* served with the current frame, or the first one to come (within the rate limits) */
+        stream = new_stream(conn, stream_id, STREAM_SNAPSHOT);
+        pthread_mutex_lock(&jpeg_mutex);
+        if (jpeg_seq && rate_limiter_consume(&stream->rate_limiter, jpeg_size)) {
+            take_frame(conn);
+            start_part(conn, stream);
+        }
+        pthread_mutex_unlock(&jpeg_mutex);
+
+        return r;
+    }
+
+    r = write_response_headers(conn, stream_id, 200, "multipart/x-mixed-replace; boundary=" BOUNDARY_SEPARATOR,
+            -1, NULL, NULL, !strcmp(req->method, "HEAD"));
+    if (r > 0 && strcmp(req->method, "HEAD")) {
+        /* frames start coming with the next one published */
+        new_stream(conn, stream_id, STREAM_MJPEG);
+    }
+
+    return r;
+}
+
+int open_stream(http2_conn_t *conn) {
+    request_t req;
+    unsigned int stream_id = conn->header_stream;
+    int r;
+
+    memset(&req, 0, sizeof(req));
+    conn->header_stream = 0;
+
+    /* the dynamic table must be kept in sync even for the requests that are refused */
+    if (hpack_decode(&conn->hpack, conn->header_block, conn->header_block_len, collect_header, &req) < 0) {
+        ERROR_CLIENT(conn->client, "http2: failed to decode header block of stream %u", stream_id);
+        free(req.auth_basic_hash);
+        write_goaway(conn, ERR_COMPRESSION_ERROR);
+
+        return -1;
+    }
+
+    if (!req.method[0] || !req.path[0]) {
+        free(req.auth_basic_hash);
+        return write_rst_stream(conn, stream_id, ERR_PROTOCOL_ERROR);
+    }
+
+    r = handle_request(conn, stream_id, &req, conn->header_end_stream);
+    free(req.auth_basic_hash);
+
+    return r;
+}
+
+
+    /* input */
+
+int apply_settings(http2_conn_t *conn, const unsigned char *payload, int len) {
+    unsigned int id, value;
+    int i, j, delta;
+
+    for (i = 0; i + 6 <= len; i += 6) {
+        id = payload[i] << 8 | payload[i + 1];
+        value = (unsigned int) payload[i + 2] << 24 | payload[i + 3] << 16 | payload[i + 4] << 8 | payload[i + 5];
+
+        switch (id) {
+            case SETTINGS_INITIAL_WINDOW_SIZE:
+                if (value > MAX_WINDOW) {
+                    return ERR_FLOW_CONTROL_ERROR;
+                }
+
+                /* applies to the streams that are already open, too */
+                delta = value - conn->initial_window;
+                conn->initial_window = value;
+                for (j = 0; j < conn->num_streams; j++) {
+                    conn->streams[j].window += delta;
+                }
+                break;
+
+            case SETTINGS_MAX_FRAME_SIZE:
+                if (value < 16384 || value > 16777215) {
+                    return ERR_PROTOCOL_ERROR;
+                }
+                conn->max_frame_size = value;
+                break;
+
+            default:
+                /* our responses never use the dynamic table, so its size doesn't matter */
+                break;
+        }
+    }
+
+    return 0;
+}
+
+int handle_frame(http2_conn_t *conn, int type, int flags, unsigned int stream_id, unsigned char *payload, int len) {
+    stream_t *stream;
+    unsigned int increment;
+    int pad = 0, r;
+
+    if (conn->header_stream && (type != FRAME_CONTINUATION || stream_id != conn->header_stream)) {
+        ERROR_CLIENT(conn->client, "http2: header block of stream %u interrupted", conn->header_stream);
+        write_goaway(conn, ERR_PROTOCOL_ERROR);
+        return -1;
+    }
+
+    switch (type) {
+        case FRAME_DATA:
+            /* not expected with our requests; the connection window is kept open anyway */
+            if (len) {
+                return write_window_update(conn, 0, len);
+            }
+            break;
+
+        case FRAME_HEADERS:
+            if (!(stream_id & 1) || stream_id <= conn->last_stream_id) {
+                ERROR_CLIENT(conn->client, "http2: unexpected stream %u", stream_id);
+                write_goaway(conn, ERR_PROTOCOL_ERROR);
+                return -1;
+            }
+            conn->last_stream_id = stream_id;
+
+            if (flags & FLAG_PADDED) {
+                pad = len ? payload[0] : 0;
+                payload++;
+                len--;
+            }
+            if (flags & FLAG_PRIORITY) {
+                payload += 5;
+                len -= 5;
+            }
+            len -= pad;
+            if (len < 0) {
+                write_goaway(conn, ERR_PROTOCOL_ERROR);
+                return -1;
+            }
+
+            conn->header_stream = stream_id;
+            conn->header_end_stream = flags & FLAG_END_STREAM;
+            conn->header_block_len = 0;
+            /* falls through */
+
+        case FRAME_CONTINUATION:
+            if (!conn->header_stream) {
+                write_goaway(conn, ERR_PROTOCOL_ERROR);
+                return -1;
+            }
+
+            if (conn->header_block_len + len > HTTP2_MAX_HEADER_BLOCK) {
+                ERROR_CLIENT(conn->client, "http2: header block too large");
+                write_goaway(conn, ERR_PROTOCOL_ERROR);
+                return -1;
+            }
+            memcpy(conn->header_block + conn->header_block_len, payload, len);
+            conn->header_block_len += len;
+
+            if (flags & FLAG_END_HEADERS) {
+                return open_stream(conn);
+            }
+            break;
+
+        case FRAME_RST_STREAM:
+            stream = find_stream(conn, stream_id);
+            if (stream) {
+                close_stream(conn, stream);
+            }
+            break;
+
+        case FRAME_SETTINGS:
+            if (flags & FLAG_ACK) {
+                break;
+            }
+            if (stream_id || len % 6) {
+                write_goaway(conn, ERR_FRAME_SIZE_ERROR);
+                return -1;
+            }
+
+            r = apply_settings(conn, payload, len);
+            if (r) {
+                write_goaway(conn, r);
+                return -1;
+            }
+
+            return write_frame(conn, FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0);
+
+        case FRAME_PUSH_PROMISE:
+            write_goaway(conn, ERR_PROTOCOL_ERROR);
+            return -1;
+
+        case FRAME_PING:
+            if (flags & FLAG_ACK) {
+                break;
+            }
+            if (len != 8) {
+                write_goaway(conn, ERR_FRAME_SIZE_ERROR);
+                return -1;
+            }
+
+            return write_frame(conn, FRAME_PING, FLAG_ACK, 0, payload, len);
+
+        case FRAME_GOAWAY:
+            DEBUG_CLIENT(conn->client, "http2: connection closed by client");
+            return 0;
+
+        case FRAME_WINDOW_UPDATE:
+            if (len != 4) {
+                write_goaway(conn, ERR_FRAME_SIZE_ERROR);
+                return -1;
+            }
+
+            increment = ((unsigned int) payload[0] << 24 | payload[1] << 16 | payload[2] << 8 | payload[3]) & MAX_WINDOW;
+            if (!stream_id) {
+                if (!increment || (int64_t) conn->window + increment > MAX_WINDOW) {
+                    write_goaway(conn, ERR_FLOW_CONTROL_ERROR);
+                    return -1;
+                }
+                conn->window += increment;
+            }
+            else if ((stream = find_stream(conn, stream_id))) {
+                if (!increment || (int64_t) stream->window + increment > MAX_WINDOW) {
+                    close_stream(conn, stream);
+                    return write_rst_stream(conn, stream_id, ERR_FLOW_CONTROL_ERROR);
+                }
+                stream->window += increment;
+            }
+            break;
+
+        default: /* priority, unknown */
+            break;
+    }
+
+    return 1;
+}
+
+int read_input(http2_conn_t *conn) {
+    unsigned char *p;
+    int size, len, offs = 0, r;
+
+    while (1) {
+        size = recv(conn->client->stream_fd, conn->rbuf + conn->rbuf_len, sizeof(conn->rbuf) - conn->rbuf_len,
+                MSG_DONTWAIT);
+        if (size < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                return 1;
+            }
+            else if (errno == ECONNRESET) {
+                return 0; /* clients often reset the connection once done with it */
+            }
+
+            ERRNO_CLIENT(conn->client, "recv() failed");
+            return -1;
+        }
+        else if (size == 0) {
+            return 0;
+        }
+
+        conn->rbuf_len += size;
+        offs = 0;
+
+        /* the client's connection preface comes first */
+        if (conn->preface_offs < sizeof(HTTP2_PREFACE) - 1) {
+            len = MIN(conn->rbuf_len, sizeof(HTTP2_PREFACE) - 1 - conn->preface_offs);
+            if (memcmp(conn->rbuf, HTTP2_PREFACE + conn->preface_offs, len)) {
+                ERROR_CLIENT(conn->client, "http2: invalid connection preface");
+                return -1;
+            }
+
+            conn->preface_offs += len;
+            offs = len;
+        }
+
+        while (conn->rbuf_len - offs >= FRAME_HEADER_LEN) {
+            p = conn->rbuf + offs;
+            len = p[0] << 16 | p[1] << 8 | p[2];
+            if (len > HTTP2_MAX_FRAME_SIZE) {
+                ERROR_CLIENT(conn->client, "http2: frame too large");
+                write_goaway(conn, ERR_FRAME_SIZE_ERROR);
+                return -1;
+            }
+            if (conn->rbuf_len - offs < FRAME_HEADER_LEN + len) {
+                break; /* incomplete frame */
+            }
+
+            r = handle_frame(conn, p[3], p[4], ((unsigned int) p[5] << 24 | p[6] << 16 | p[7] << 8 | p[8]) & MAX_WINDOW,
+                    p + FRAME_HEADER_LEN, len);
+            if (r <= 0) {
+                return r;
+            }
+
+            offs += FRAME_HEADER_LEN + len;
+        }
+
+        conn->rbuf_len -= offs;
+        memmove(conn->rbuf, conn->rbuf + offs, conn->rbuf_len);
+    }
+}
+
+int flush(http2_conn_t *conn) {
+    unsigned char header[FRAME_HEADER_LEN];
+    struct iovec iov[3];
+    stream_t *stream;
+    int i, n, len, header_part, flags, progress, written;
+
+    /* a DATA frame at a time for each stream, so that they share the connection window fairly */
+    do {
+        progress = 0;
+
+        for (i = 0; i < conn->num_streams; i++) {
+            stream = &conn->streams[i];
+            len = stream->header_len + stream->size - stream->offs;
+            if (!stream->data || len <= 0) {
+                continue;
+            }
+
+            len = MIN(MIN(len, conn->max_frame_size), MIN(stream->window, conn->window));
+            if (len <= 0) {
+                continue; /* the client will open the window */
+            }
+
+            flags = stream->offs + len == stream->header_len + stream->size && stream->end_stream ? FLAG_END_STREAM : 0;
+            header[0] = len >> 16;
+            header[1] = len >> 8;
+            header[2] = len;
+            header[3] = FRAME_DATA;
+            header[4] = flags;
+            header[5] = (stream->id >> 24) & 0x7F;
+            header[6] = stream->id >> 16;
+            header[7] = stream->id >> 8;
+            header[8] = stream->id;
+
+            n = 0;
+            iov[n].iov_base = header;
+            iov[n++].iov_len = FRAME_HEADER_LEN;
+
+            header_part = 0;
+            if (stream->offs < stream->header_len) {
+                header_part = MIN(len, stream->header_len - stream->offs);
+                iov[n].iov_base = stream->header + stream->offs;
+                iov[n++].iov_len = header_part;
+            }
+            if (len > header_part) {
+                iov[n].iov_base = (char *) stream->data + stream->offs + header_part - stream->header_len;
+                iov[n++].iov_len = len - header_part;
+            }
+
+            written = writev(conn->client->stream_fd, iov, n);
+            if (written < 0) {
+                if (errno == EPIPE || errno == EINTR) {
+                    return 0;
+                }
+
+                ERRNO_CLIENT(conn->client, "writev() failed");
+                return -1;
+            }
+            else if (written < FRAME_HEADER_LEN + len) {
+                ERROR_CLIENT(conn->client, "not all data could be written");
+                return -1;
+            }
+
+            stream->offs += len;
+            stream->window -= len;
+            conn->window -= len;
+            progress = 1;
+
+            if (stream->offs < stream->header_len + stream->size) {
+                continue;
+            }
+
+            /* done with this part */
+            if (stream->end_stream) {
+                if (stream->type == STREAM_SNAPSHOT) {
+                    conn->client->frames_sent++;
+                }
+                close_stream(conn, stream);
+                i--;
+                continue;
+            }
+
+            conn->client->frames_sent++;
+            release_copy(stream->copy);
+            stream->copy = NULL;
+            stream->data = NULL;
+        }
+    } while (progress);
+
+    return 1;
+}
+
+int decode_base64url(const char *src, unsigned char *dest, int max_len) {
+    static const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+    unsigned int acc = 0;
+    int bits = 0, len = 0;
+    const char *p;
+
+    for (; *src && *src != '='; src++) {
+        p = strchr(alphabet, *src);
+        if (!p) {
+            return -1;
+        }
+
+        acc = acc << 6 | (p - alphabet);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            if (len >= max_len) {
+                return -1;
+            }
+            dest[len++] = acc >> bits;
+        }
+    }
+
+    return len;
+}
+
+
+    /* serving */
+
+int http2_detect(client_t *client) {
+    char buf[3];
+
+    /* every HTTP/1.x request line is longer than this, so waiting for it never blocks for nothing */
+    if (recv(client->stream_fd, buf, sizeof(buf), MSG_PEEK | MSG_WAITALL) != sizeof(buf)) {
+        return 0;
+    }
+
+    if (memcmp(buf, "PRI", sizeof(buf))) {
+        return 0;
+    }
+
+    client->http2 = HTTP2_PRIOR_KNOWLEDGE;
+
+    return 1;
+}
+
+void http2_wake(client_t *client) {
+    /* must be called with the jpeg mutex locked */
+    uint64_t value = 1;
+
+    if (write(client->http2_conn->wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        ERRNO_CLIENT(client, "write() failed");
+    }
+}
+
+void http2_serve(client_t *client) {
+    http2_conn_t *conn = malloc(sizeof(http2_conn_t));
+    struct pollfd fds[2];
+    unsigned char settings[HTTP2_MAX_FRAME_SIZE];
+    uint64_t value;
+    request_t req;
+    double cpu_start, wall_start;
+    int len, r = 1, delivered = 0;
+
+    memset(conn, 0, sizeof(http2_conn_t));
+    conn->client = client;
+    conn->window = HTTP2_DEF_WINDOW;
+    conn->initial_window = HTTP2_DEF_WINDOW;
+    conn->max_frame_size = HTTP2_MAX_FRAME_SIZE;
+    conn->idle_since = get_now();
+    conn->header_block = malloc(HTTP2_MAX_HEADER_BLOCK);
+    hpack_decoder_init(&conn->hpack, HPACK_DEF_TABLE_SIZE);
+
+    conn->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (conn->wake_fd < 0) {
+        ERRNO_CLIENT(client, "eventfd() failed");
+        goto done;
+    }
+
+    /* by the listen address, or the credentials of the upgraded request */
+    client->priority = auth_priority(client->auth_basic_hash, client->stream_fd);
+
+    if (client->http2 == HTTP2_UPGRADE) {
+        DEBUG_CLIENT(client, "http2: upgrading connection");
+        if (write_to_client(client, (char *) RESPONSE_UPGRADE_HEADER, strlen(RESPONSE_UPGRADE_HEADER)) <= 0) {
+            goto done;
+        }
+    }
+    else {
+        DEBUG_CLIENT(client, "http2: connection with prior knowledge");
+    }
+
+    if (write_settings(conn) <= 0) {
+        goto done;
+    }
+
+    if (client->http2 == HTTP2_UPGRADE) {
+        len = decode_base64url(client->http2_settings, settings, sizeof(settings));
+        if (len < 0 || len % 6 || apply_settings(conn, settings, len)) {
+            ERROR_CLIENT(client, "http2: invalid HTTP2-Settings header");
+            goto done;
+        }
+
+        /* the upgraded request becomes stream 1, already authorized */
+        memset(&req, 0, sizeof(req));
+        snprintf(req.method, sizeof(req.method), "%s", client->method);
+        snprintf(req.path, sizeof(req.path), "%s", client->uri);
+        req.authorized = 1;
+        conn->last_stream_id = 1;
+        if (handle_request(conn, 1, &req, 1) <= 0) {
+            goto done;
+        }
+    }
+
+    /* from now on, publishing a frame wakes us up */
+    pthread_mutex_lock(&jpeg_mutex);
+    client->http2_conn = conn;
+    client->streaming = 1;
+    pthread_mutex_unlock(&jpeg_mutex);
+
+    fds[0].fd = client->stream_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = conn->wake_fd;
+    fds[1].events = POLLIN;
+
+    while (running) {
+        if (client->shed) {
+            INFO_CLIENT(client, "overloaded, shedding low priority client");
+            break;
+        }
+
+        if (delivered && load_enabled()) {
+            /* accounted for once per frame, like the send loops of the other clients */
+            delivered = 0;
+            cpu_start = load_cpu_time();
+            wall_start = get_now();
+            r = flush(conn);
+            load_account(client, 0, cpu_start, wall_start);
+        }
+        else {
+            r = flush(conn);
+        }
+        if (r <= 0) {
+            break;
+        }
+
+        if (poll(fds, 2, HTTP2_POLL_TIMEOUT) < 0 && errno != EINTR) {
+            ERRNO_CLIENT(client, "poll() failed");
+            break;
+        }
+
+        if (fds[0].revents) {
+            r = read_input(conn);
+            if (r <= 0) {
+                break;
+            }
+        }
+
+        if (read(conn->wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+            ERRNO_CLIENT(client, "read() failed");
+            break;
+        }
+
+        pthread_mutex_lock(&jpeg_mutex);
+        if (handoff_parking) {
+            /* streams can't be handed off; the client reconnects */
+            pthread_mutex_unlock(&jpeg_mutex);
+            break;
+        }
+        if (client->jpeg_ready) {
+            client->jpeg_ready = 0;
+            if (load_skip_frame(client, jpeg_seq)) {
+                client->frames_skipped++;
+            }
+            else {
+                take_frame(conn);
+                deliver(conn);
+                delivered = 1;
+            }
+        }
+        pthread_mutex_unlock(&jpeg_mutex);
+
+        if (!conn->num_streams && get_now() - conn->idle_since > IDLE_TIMEOUT) {
+            DEBUG_CLIENT(client, "http2: idle connection");
+            break;
+        }
+    }
+
+    if (r > 0) {
+        write_goaway(conn, ERR_NO_ERROR);
+    }
+
+done:
+    /* publishing frames must not touch the event fd once it's closed */
+    pthread_mutex_lock(&jpeg_mutex);
+    client->http2_conn = NULL;
+    client->streaming = 0;
+    pthread_mutex_unlock(&jpeg_mutex);
+
+    while (conn->num_streams) {
+        close_stream(conn, &conn->streams[0]);
+    }
+    release_copy(conn->latest);
+    hpack_decoder_free(&conn->hpack);
+    free(conn->header_block);
+    if (conn->wake_fd >= 0) {
+        close(conn->wake_fd);
+    }
+    free(conn);
+
+    cleanup_client(client);
+}
@@ -0,0 +1,41 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HTTP2_H
+#define __HTTP2_H
+
+#include "client.h"
+
+#define HTTP2_PRIOR_KNOWLEDGE   1 /* the client started with the connection preface */
+#define HTTP2_UPGRADE           2 /* the client asked to upgrade an HTTP/1.1 request */
+
+#define HTTP2_PREFACE           "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define HTTP2_MAX_STREAMS       64 /* concurrent streams per connection */
+#define HTTP2_MAX_FRAME_SIZE    16384 /* the largest frame we accept, the protocol's default */
+#define HTTP2_MAX_HEADER_BLOCK  65536
+#define HTTP2_DEF_WINDOW        65535
+#define HTTP2_POLL_TIMEOUT      1000 /* milliseconds */
+
+
+int                 http2_detect(client_t *client);
+void                http2_serve(client_t *client);
+void                http2_wake(client_t *client);
+
+
+#endif /* __HTTP2_H */
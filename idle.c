@@ -0,0 +1,138 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "common.h"
+#include "uring.h"
+#include "idle.h"
+
+
+/* with no client to serve, the input is merely drained: whenever possible, it's spliced
+ * straight into /dev/null, without ever being copied to user space, while the listening socket
+ * is watched as well, so that the first client is noticed right away, even with a paused producer;
+ * the producer itself can be told to pause (or slow down) through a control FIFO */
+
+
+    /* locals */
+
+static int null_fd = -1;
+static int control_fd = -1;
+static int can_splice = 1;
+
+
+int idle_init(char *control_path) {
+    null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (null_fd < 0) {
+        ERRNO("open() failed");
+        return -1;
+    }
+
+    if (!control_path) {
+        return 0;
+    }
+
+    if (mkfifo(control_path, 0600) < 0 && errno != EEXIST) {
+        ERRNO("mkfifo() failed");
+        return -1;
+    }
+
+    /* opened for both reading and writing, so that neither opening nor writing
+     * depends on whether the producer has the FIFO open at that moment */
+    control_fd = open(control_path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (control_fd < 0) {
+        ERRNO("open() failed");
+        return -1;
+    }
+
+    DEBUG("idle: using control FIFO %s", control_path);
+
+    return 0;
+}
+
+int idle_drain(int socket_fd, char *buf, int len) {
+    struct pollfd fds[2];
+    int size;
+
+    if (uring_enabled()) {
+        /* the input and the listening socket are both handled by the ring,
+         * which returns early (EAGAIN) when a client connects */
+        return uring_read(STDIN_FILENO, buf, len);
+    }
+
+    fds[0].fd = STDIN_FILENO;
+    fds[0].events = POLLIN;
+    fds[1].fd = socket_fd;
+    fds[1].events = POLLIN;
+
+    if (poll(fds, 2, -1) < 0) {
+        return -1;
+    }
+
+    if (fds[1].revents) {
+        errno = EAGAIN; /* a client is waiting to be accepted */
+        return -1;
+    }
+
+    if (can_splice) {
+        size = splice(STDIN_FILENO, NULL, null_fd, NULL, len, SPLICE_F_NONBLOCK);
+        if (size >= 0 || (errno != EINVAL && errno != ESPIPE)) {
+            return size;
+        }
+
+        DEBUG("idle: input can't be spliced, reading it instead");
+        can_splice = 0;
+    }
+
+    return read(STDIN_FILENO, buf, len);
+}
+
+void idle_notify(int idle) {
+    char *msg = idle ? IDLE_PAUSE_MSG : IDLE_RESUME_MSG;
+
+    if (control_fd < 0) {
+        return;
+    }
+
+    DEBUG("idle: telling the producer to %s", idle ? "pause" : "resume");
+
+    if (write(control_fd, msg, strlen(msg)) < 0) {
+        ERRNO("idle: write() failed");
+    }
+}
+
+void idle_stop() {
+    if (null_fd >= 0) {
+        close(null_fd);
+        null_fd = -1;
+    }
+
+    if (control_fd >= 0) {
+        close(control_fd);
+        control_fd = -1;
+    }
+}
@@ -0,0 +1,33 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __IDLE_H
+#define __IDLE_H
+
+#define IDLE_PAUSE_MSG          "pause\n"
+#define IDLE_RESUME_MSG         "resume\n"
+
+
+int                 idle_init(char *control_path);
+int                 idle_drain(int socket_fd, char *buf, int len);
+void                idle_notify(int idle);
+void                idle_stop();
+
+
+#endif /* __IDLE_H */
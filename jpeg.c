@@ -0,0 +1,735 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "jpeg.h"
+
+
+const unsigned char jpeg_std_dc_luminance[] = {
+    0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0,
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11
+};
+
+const unsigned char jpeg_std_dc_chrominance[] = {
+    0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0,
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11
+};
+
+const unsigned char jpeg_std_ac_luminance[] = {
+    0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d,
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12,
+    0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+    0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16,
+    0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
+    0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+    0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79,
+    0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98,
+    0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+    0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4,
+    0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea,
+    0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+const unsigned char jpeg_std_ac_chrominance[] = {
+    0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77,
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21,
+    0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+    0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34,
+    0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38,
+    0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+    0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78,
+    0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96,
+    0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+    0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2,
+    0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9,
+    0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+
+typedef struct {
+    unsigned short  lookup[256]; /* length << 8 | symbol, for the codes of up to 8 bits, 0 otherwise */
+    int             max_code[17]; /* by code length, -1 when there's no code of that length */
+    int             sym_offs[17]; /* by code length, index of the symbols, relative to the codes */
+    const unsigned char *symbols;
+} huffman_decoder_t;
+
+
+    /* local functions */
+
+static int          is_std_huffman_table(int table_class, int table_id, const unsigned char *table, int len);
+static int          init_decoder(huffman_decoder_t *dec, const unsigned char *table);
+static void         unstuff(jpeg_index_t *index, const unsigned char *buf, int len);
+
+
+int jpeg_huffman_table_len(const unsigned char *table) {
+    int i, len = 16;
+
+    for (i = 0; i < 16; i++) {
+        len += table[i];
+    }
+
+    return len;
+}
+
+int is_std_huffman_table(int table_class, int table_id, const unsigned char *table, int len) {
+    const unsigned char *std;
+
+    /* by convention, table 0 is used for luminance and table 1 for chrominance */
+    if (table_id > 1) {
+        return 0;
+    }
+
+    if (table_class == 0) {
+        std = table_id ? jpeg_std_dc_chrominance : jpeg_std_dc_luminance;
+    }
+    else {
+        std = table_id ? jpeg_std_ac_chrominance : jpeg_std_ac_luminance;
+    }
+
+    return len == jpeg_huffman_table_len(std) && !memcmp(table, std, len);
+}
+
+int jpeg_parse(const unsigned char *buf, int len, jpeg_info_t *info) {
+    const unsigned char *seg;
+    int offs = 2, marker, seg_len, i, j, table_len;
+
+    memset(info, 0, sizeof(jpeg_info_t));
+    info->std_huffman = 1; /* no DHT segment implies the standard tables (common with MJPEG) */
+
+    if (len < 4 || buf[0] != 0xFF || buf[1] != JPEG_MARKER_SOI) {
+        return -1;
+    }
+
+    /* walk the segments by their lengths, up to the start of scan */
+    while (offs + 4 <= len) {
+        if (buf[offs] != 0xFF) {
+            return -1;
+        }
+
+        marker = buf[offs + 1];
+        if (marker == 0xFF) { /* fill byte */
+            offs++;
+            continue;
+        }
+
+        seg_len = buf[offs + 2] << 8 | buf[offs + 3];
+        if (seg_len < 2 || offs + 2 + seg_len > len) {
+            return -1;
+        }
+
+        seg = buf + offs + 4;
+        seg_len -= 2;
+
+        switch (marker) {
+            case JPEG_MARKER_SOF0:
+            case JPEG_MARKER_SOF1:
+            case JPEG_MARKER_SOF2:
+                if (seg_len < 6) {
+                    return -1;
+                }
+
+                info->progressive = (marker == JPEG_MARKER_SOF2);
+                info->precision = seg[0];
+                info->height = seg[1] << 8 | seg[2];
+                info->width = seg[3] << 8 | seg[4];
+                info->num_components = seg[5];
+                if (info->num_components > JPEG_MAX_COMPONENTS || seg_len < 6 + 3 * info->num_components) {
+                    return -1;
+                }
+
+                for (i = 0; i < info->num_components; i++) {
+                    info->component_id[i] = seg[6 + 3 * i];
+                    info->h_samp[i] = seg[7 + 3 * i] >> 4;
+                    info->v_samp[i] = seg[7 + 3 * i] & 0x0F;
+                    info->tq[i] = seg[8 + 3 * i] & 0x03;
+                }
+                break;
+
+            case JPEG_MARKER_DQT:
+                for (i = 0; i < seg_len; ) {
+                    int precision = seg[i] >> 4;
+                    int id = seg[i] & 0x03;
+                    if (i + 1 + (precision ? 128 : 64) > seg_len) {
+                        return -1; /* truncated table */
+                    }
+
+                    info->qtables[id] = seg + i + 1;
+                    info->qtable_precision[id] = precision;
+                    i += 1 + (precision ? 128 : 64);
+                }
+                break;
+
+            case JPEG_MARKER_DHT:
+                for (i = 0; i + 17 <= seg_len; ) {
+                    table_len = jpeg_huffman_table_len(seg + i + 1);
+                    if (i + 1 + table_len > seg_len) {
+                        return -1;
+                    }
+
+                    if (!is_std_huffman_table(seg[i] >> 4, seg[i] & 0x0F, seg + i + 1, table_len)) {
+                        info->std_huffman = 0;
+                    }
+                    info->huffman_tables[(seg[i] >> 4) & 0x01][seg[i] & 0x03] = seg + i + 1;
+
+                    i += 1 + table_len;
+                }
+                break;
+
+            case JPEG_MARKER_DRI:
+                if (seg_len < 2) {
+                    return -1;
+                }
+
+                info->restart_interval = seg[0] << 8 | seg[1];
+                break;
+
+            case JPEG_MARKER_SOS:
+                if (!info->num_components) {
+                    return -1; /* no frame header */
+                }
+
+                info->scan_num_components = seg_len ? seg[0] : 0;
+                if (info->scan_num_components > info->num_components ||
+                    seg_len < 4 + 2 * info->scan_num_components) {
+
+                    return -1;
+                }
+
+                for (i = 0; i < info->scan_num_components; i++) {
+                    for (j = 0; j < info->num_components; j++) {
+                        if (info->component_id[j] == seg[1 + 2 * i]) {
+                            break;
+                        }
+                    }
+                    if (j == info->num_components) {
+                        return -1; /* unknown component */
+                    }
+
+                    info->scan_component[i] = j;
+                    info->scan_dc_table[i] = (seg[2 + 2 * i] >> 4) & 0x03;
+                    info->scan_ac_table[i] = seg[2 + 2 * i] & 0x03;
+                }
+                info->scan_spectral_end = seg[2 + 2 * i];
+
+                info->scan_offset = offs + 4 + seg_len;
+
+                /* the entropy coded data runs up to the end of image marker */
+                for (i = len - 2; i >= info->scan_offset; i--) {
+                    if (buf[i] == 0xFF && buf[i + 1] == JPEG_MARKER_EOI) {
+                        break;
+                    }
+                }
+
+                if (i < info->scan_offset) {
+                    return -1;
+                }
+
+                info->scan_len = i - info->scan_offset;
+
+                return 0;
+        }
+
+        offs += 4 + seg_len;
+    }
+
+    return -1;
+}
+
+const char *jpeg_subsampling_name(jpeg_info_t *info) {
+    int h, v;
+
+    if (info->num_components == 1) {
+        return "gray";
+    }
+    if (info->num_components != 3 || !info->h_samp[1] || !info->v_samp[1]) {
+        return "other";
+    }
+
+    /* luma sampling factors relative to the (first) chroma component */
+    h = info->h_samp[0] / info->h_samp[1];
+    v = info->v_samp[0] / info->v_samp[1];
+
+    if (h == 1 && v == 1) {
+        return "4:4:4";
+    }
+    else if (h == 2 && v == 1) {
+        return "4:2:2";
+    }
+    else if (h == 2 && v == 2) {
+        return "4:2:0";
+    }
+    else if (h == 1 && v == 2) {
+        return "4:4:0";
+    }
+    else if (h == 4 && v == 1) {
+        return "4:1:1";
+    }
+
+    return "other";
+}
+
+
+    /* framing */
+
+void jpeg_framer_reset(jpeg_framer_t *framer) {
+    memset(framer, 0, sizeof(jpeg_framer_t));
+}
+
+int jpeg_framer_feed(jpeg_framer_t *framer, const unsigned char *buf, int len) {
+    const unsigned char *p;
+    int marker, seg_len;
+
+    /* the segments are skipped according to their length fields, so that
+     * markers embedded in their payload (e.g. EXIF thumbnails) are ignored;
+     * only the entropy coded data is scanned byte by byte */
+    while (1) {
+        switch (framer->state) {
+            case JPEG_FRAMER_SOI:
+                p = memmem(buf + framer->offs, len - framer->offs, "\xFF\xD8", 2);
+                if (!p) {
+                    framer->offs = MAX(framer->offs, len - 1);
+                    return -1;
+                }
+
+                framer->start = p - buf;
+                framer->offs = framer->start + 2;
+                framer->state = JPEG_FRAMER_MARKER;
+                break;
+
+            case JPEG_FRAMER_MARKER:
+                if (framer->offs + 2 > len) {
+                    return -1;
+                }
+
+                if (buf[framer->offs] != 0xFF) {
+                    /* lost sync, drop this frame and look for the next one */
+                    framer->state = JPEG_FRAMER_SOI;
+                    break;
+                }
+
+                marker = buf[framer->offs + 1];
+                if (marker == 0xFF) { /* fill byte */
+                    framer->offs++;
+                    break;
+                }
+                else if (marker == JPEG_MARKER_EOI) {
+                    framer->offs += 2;
+                    framer->state = JPEG_FRAMER_SOI;
+                    return framer->offs;
+                }
+                else if (marker == JPEG_MARKER_SOI) {
+                    /* truncated frame, start over */
+                    framer->start = framer->offs;
+                    framer->offs += 2;
+                    break;
+                }
+                else if (marker == JPEG_MARKER_TEM || (marker >= JPEG_MARKER_RST0 && marker <= JPEG_MARKER_RST7)) {
+                    framer->offs += 2; /* standalone markers */
+                    break;
+                }
+
+                if (framer->offs + 4 > len) {
+                    return -1;
+                }
+
+                seg_len = buf[framer->offs + 2] << 8 | buf[framer->offs + 3];
+                if (seg_len < 2) {
+                    framer->state = JPEG_FRAMER_SOI;
+                    break;
+                }
+
+                framer->offs += 2 + seg_len;
+                if (marker == JPEG_MARKER_SOS) {
+                    framer->state = JPEG_FRAMER_ENTROPY;
+                }
+                break;
+
+            case JPEG_FRAMER_ENTROPY:
+                while (1) {
+                    if (framer->offs >= len) {
+                        return -1;
+                    }
+
+                    p = memchr(buf + framer->offs, 0xFF, len - framer->offs);
+                    if (!p) {
+                        framer->offs = len;
+                        return -1;
+                    }
+                    if (p + 1 >= buf + len) {
+                        framer->offs = p - buf;
+                        return -1;
+                    }
+
+                    marker = p[1];
+                    if (marker == 0x00 || (marker >= JPEG_MARKER_RST0 && marker <= JPEG_MARKER_RST7)) {
+                        framer->offs = p - buf + 2; /* stuffed byte or restart marker */
+                    }
+                    else if (marker == 0xFF) {
+                        framer->offs = p - buf + 1;
+                    }
+                    else {
+                        /* end of scan; either another segment (progressive frames) or EOI */
+                        framer->offs = p - buf;
+                        framer->state = JPEG_FRAMER_MARKER;
+                        break;
+                    }
+                }
+                break;
+        }
+    }
+}
+
+int jpeg_find_separator(const unsigned char *buf, int len, const char *separator, int separator_len, int look_behind) {
+    /* only the last look_behind bytes are searched, the rest of the buffer having been searched
+     * as it came in; returns the offset of the separator, -1 if there's none */
+    const unsigned char *p;
+    int start = len - MIN(look_behind, len);
+
+    p = memmem(buf + start, len - start, separator, separator_len);
+
+    return p ? p - buf : -1;
+}
+
+int jpeg_strip_metadata(unsigned char *buf, int len) {
+    int offs = 2, out = 2, marker, seg_len;
+
+    if (len < 4 || buf[0] != 0xFF || buf[1] != JPEG_MARKER_SOI) {
+        return len;
+    }
+
+    /* drop the APPn (except for the Adobe one, which tells the color transform) and COM segments
+     * found before the first scan, moving everything else down over them */
+    while (offs + 4 <= len && buf[offs] == 0xFF) {
+        marker = buf[offs + 1];
+        seg_len = buf[offs + 2] << 8 | buf[offs + 3];
+        if (marker == JPEG_MARKER_SOS || seg_len < 2 || offs + 2 + seg_len > len) {
+            break;
+        }
+
+        if ((marker >= JPEG_MARKER_APP0 && marker <= JPEG_MARKER_APP15 && marker != JPEG_MARKER_APP14) ||
+                marker == JPEG_MARKER_COM) {
+
+            offs += 2 + seg_len;
+            continue;
+        }
+
+        if (out != offs) {
+            memmove(buf + out, buf + offs, 2 + seg_len);
+        }
+        out += 2 + seg_len;
+        offs += 2 + seg_len;
+    }
+
+    if (out == offs) {
+        return len; /* nothing stripped */
+    }
+
+    memmove(buf + out, buf + offs, len - offs);
+
+    return len - (offs - out);
+}
+
+
+    /* decoding */
+
+static inline int decode_symbol(huffman_decoder_t *dec, const unsigned char *data, unsigned int *offs) {
+    unsigned int bits = jpeg_peek_bits(data, *offs, 16);
+    int entry = dec->lookup[bits >> 8], len, code;
+
+    if (entry) {
+        *offs += entry >> 8;
+        return entry & 0xFF;
+    }
+
+    for (len = 9; len <= 16; len++) {
+        code = bits >> (16 - len);
+        if (code <= dec->max_code[len]) {
+            *offs += len;
+            return dec->symbols[dec->sym_offs[len] + code];
+        }
+    }
+
+    return -1;
+}
+
+int init_decoder(huffman_decoder_t *dec, const unsigned char *table) {
+    int len, i, j, code = 0, k = 0;
+
+    memset(dec->lookup, 0, sizeof(dec->lookup));
+    dec->symbols = table + 16;
+
+    for (len = 1; len <= 16; len++) {
+        dec->sym_offs[len] = k - code;
+        dec->max_code[len] = table[len - 1] ? code + table[len - 1] - 1 : -1;
+
+        for (i = 0; i < table[len - 1]; i++, code++, k++) {
+            if (code >= (1 << len)) {
+                return -1; /* too many codes of this length */
+            }
+
+            if (len <= 8) {
+                for (j = 0; j < (1 << (8 - len)); j++) {
+                    dec->lookup[code << (8 - len) | j] = len << 8 | dec->symbols[k];
+                }
+            }
+        }
+
+        code <<= 1;
+    }
+
+    return 0;
+}
+
+const unsigned char *jpeg_huffman_table(jpeg_info_t *info, int table_class, int id) {
+    if (info->huffman_tables[table_class][id]) {
+        return info->huffman_tables[table_class][id];
+    }
+
+    /* no DHT segment implies the standard tables (common with MJPEG) */
+    if (table_class == 0) {
+        return id ? jpeg_std_dc_chrominance : jpeg_std_dc_luminance;
+    }
+    else {
+        return id ? jpeg_std_ac_chrominance : jpeg_std_ac_luminance;
+    }
+}
+
+void unstuff(jpeg_index_t *index, const unsigned char *buf, int len) {
+    const unsigned char *end = buf + len, *p = buf, *ff;
+
+    if (len + JPEG_DATA_SLACK > index->data_max_len) {
+        index->data_max_len = len + JPEG_DATA_SLACK;
+        index->data = realloc(index->data, index->data_max_len);
+    }
+
+    index->data_len = 0;
+    index->num_restarts = 0;
+
+    while (p < end) {
+        ff = memchr(p, 0xFF, end - p);
+        if (!ff) {
+            ff = end;
+        }
+
+        memcpy(index->data + index->data_len, p, ff - p);
+        index->data_len += ff - p;
+        p = ff;
+
+        if (p + 1 >= end) {
+            break;
+        }
+
+        if (p[1] == 0x00) {
+            index->data[index->data_len++] = 0xFF;
+            p += 2;
+        }
+        else if (p[1] >= JPEG_MARKER_RST0 && p[1] <= JPEG_MARKER_RST7) {
+            if (index->num_restarts >= index->max_restarts) {
+                index->max_restarts = MAX(16, 2 * index->max_restarts);
+                index->restarts = realloc(index->restarts, sizeof(int) * index->max_restarts);
+            }
+            index->restarts[index->num_restarts++] = index->data_len;
+            p += 2;
+        }
+        else if (p[1] == 0xFF) {
+            p++; /* fill byte */
+        }
+        else {
+            break; /* any other marker ends the scan */
+        }
+    }
+
+    memset(index->data + index->data_len, 0xFF, JPEG_DATA_SLACK);
+}
+
+int jpeg_index_frame(jpeg_index_t *index, const unsigned char *buf, int len) {
+    jpeg_info_t *info = &index->info;
+    int c, i, h_max = 1, v_max = 1;
+
+    index->indexed_mcus = 0;
+
+    if (jpeg_parse(buf, len, info) < 0 || info->progressive || info->precision != 8 ||
+        !info->width || !info->height || info->scan_spectral_end != 63 ||
+        info->scan_num_components != info->num_components) {
+
+        return -1;
+    }
+
+    index->blocks_per_mcu = 0;
+    for (c = 0; c < info->num_components; c++) {
+        h_max = MAX(h_max, info->h_samp[c]);
+        v_max = MAX(v_max, info->v_samp[c]);
+    }
+
+    if (info->num_components == 1) {
+        /* a non-interleaved scan, made of single blocks */
+        index->block_component[index->blocks_per_mcu++] = 0;
+        index->mcu_w = index->mcu_h = 8;
+    }
+    else {
+        for (c = 0; c < info->scan_num_components; c++) {
+            i = info->scan_component[c];
+            if (!info->h_samp[i] || !info->v_samp[i] ||
+                index->blocks_per_mcu + info->h_samp[i] * info->v_samp[i] > JPEG_MAX_BLOCKS_PER_MCU) {
+
+                return -1;
+            }
+
+            for (i = info->h_samp[i] * info->v_samp[i]; i > 0; i--) {
+                index->block_component[index->blocks_per_mcu++] = c;
+            }
+        }
+
+        index->mcu_w = 8 * h_max;
+        index->mcu_h = 8 * v_max;
+    }
+
+    index->mcus_x = (info->width + index->mcu_w - 1) / index->mcu_w;
+    index->mcus_y = (info->height + index->mcu_h - 1) / index->mcu_h;
+
+    unstuff(index, buf + info->scan_offset, info->scan_len);
+
+    return 0;
+}
+
+int jpeg_index_blocks(jpeg_index_t *index, int num_mcus) {
+    huffman_decoder_t dc_decoders[JPEG_MAX_COMPONENTS], ac_decoders[JPEG_MAX_COMPONENTS];
+    jpeg_info_t *info = &index->info;
+    const unsigned char *data = index->data;
+    int pred[JPEG_MAX_COMPONENTS];
+    unsigned int offs = 0, limit = index->data_len * 8;
+    int m, b, c, k, s, r, v;
+    jpeg_block_t *block;
+
+    /* the blocks are indexed only up to the last MCU anybody needs */
+    num_mcus = MIN(num_mcus, index->mcus_x * index->mcus_y);
+    if (num_mcus <= index->indexed_mcus) {
+        return 0;
+    }
+
+    for (c = 0; c < info->scan_num_components; c++) {
+        if (init_decoder(&dc_decoders[c], jpeg_huffman_table(info, 0, info->scan_dc_table[c])) < 0 ||
+            init_decoder(&ac_decoders[c], jpeg_huffman_table(info, 1, info->scan_ac_table[c])) < 0) {
+
+            return -1;
+        }
+    }
+
+    if (num_mcus * index->blocks_per_mcu > index->max_blocks) {
+        index->max_blocks = num_mcus * index->blocks_per_mcu;
+        index->blocks = realloc(index->blocks, sizeof(jpeg_block_t) * index->max_blocks);
+    }
+
+    memset(pred, 0, sizeof(pred));
+    block = index->blocks;
+
+    for (m = 0; m < num_mcus; m++) {
+        if (info->restart_interval && m && m % info->restart_interval == 0) {
+            r = m / info->restart_interval - 1;
+            if (r >= index->num_restarts) {
+                return -1;
+            }
+
+            offs = index->restarts[r] * 8;
+            memset(pred, 0, sizeof(pred));
+        }
+
+        for (b = 0; b < index->blocks_per_mcu; b++, block++) {
+            c = index->block_component[b];
+
+            s = decode_symbol(&dc_decoders[c], data, &offs);
+            if (s < 0 || s > JPEG_MAX_DC_CATEGORY || offs > limit) {
+                return -1;
+            }
+
+            if (s) {
+                v = jpeg_peek_bits(data, offs, s);
+                offs += s;
+                if (v < (1 << (s - 1))) {
+                    v -= (1 << s) - 1;
+                }
+                pred[c] += v;
+            }
+
+            block->dc = pred[c];
+            block->ac_offs = offs;
+
+            /* the AC coefficients are skipped over, never reconstructed */
+            for (k = 1; k < 64; k++) {
+                s = decode_symbol(&ac_decoders[c], data, &offs);
+                if (s < 0 || offs > limit) {
+                    return -1;
+                }
+
+                if (!(s & 0x0F)) {
+                    if (s != 0xF0) {
+                        break; /* end of block */
+                    }
+
+                    k += 15; /* a run of 16 zeros */
+                    continue;
+                }
+
+                k += s >> 4;
+                offs += s & 0x0F;
+            }
+
+            if (k > 64 || offs > limit) {
+                return -1;
+            }
+
+            block->ac_len = offs - block->ac_offs;
+        }
+    }
+
+    index->indexed_mcus = num_mcus;
+
+    return 0;
+}
+
+void jpeg_index_free(jpeg_index_t *index) {
+    free(index->data);
+    free(index->restarts);
+    free(index->blocks);
+    memset(index, 0, sizeof(jpeg_index_t));
+}
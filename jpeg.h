@@ -0,0 +1,141 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __JPEG_H
+#define __JPEG_H
+
+#define JPEG_MAX_COMPONENTS     4
+#define JPEG_MAX_BLOCKS_PER_MCU 10 /* the limit set by the standard */
+#define JPEG_MAX_DC_CATEGORY    11 /* for 8 bit samples */
+#define JPEG_DATA_SLACK         8 /* bytes past the end of the unstuffed data, so that bits can be peeked at freely */
+
+#define JPEG_MARKER_SOF0        0xC0
+#define JPEG_MARKER_SOF1        0xC1
+#define JPEG_MARKER_SOF2        0xC2
+#define JPEG_MARKER_DHT         0xC4
+#define JPEG_MARKER_RST0        0xD0
+#define JPEG_MARKER_RST7        0xD7
+#define JPEG_MARKER_SOI         0xD8
+#define JPEG_MARKER_EOI         0xD9
+#define JPEG_MARKER_SOS         0xDA
+#define JPEG_MARKER_DQT         0xDB
+#define JPEG_MARKER_DRI         0xDD
+#define JPEG_MARKER_APP0        0xE0
+#define JPEG_MARKER_APP14       0xEE
+#define JPEG_MARKER_APP15       0xEF
+#define JPEG_MARKER_COM         0xFE
+#define JPEG_MARKER_TEM         0x01
+
+#define JPEG_FRAMER_SOI         0 /* looking for the start of image */
+#define JPEG_FRAMER_MARKER      1 /* walking the segments by their lengths */
+#define JPEG_FRAMER_ENTROPY     2 /* scanning the entropy coded data for the next marker */
+
+typedef struct {
+    int                     width;
+    int                     height;
+    int                     precision;
+    int                     progressive;
+    int                     num_components;
+    int                     component_id[JPEG_MAX_COMPONENTS];
+    int                     h_samp[JPEG_MAX_COMPONENTS];
+    int                     v_samp[JPEG_MAX_COMPONENTS];
+    int                     tq[JPEG_MAX_COMPONENTS]; /* quantization table index */
+
+    const unsigned char *   qtables[4]; /* 64 entries each, in zigzag order */
+    int                     qtable_precision[4];
+
+    int                     restart_interval;
+    int                     std_huffman; /* whether only the standard (Annex K) huffman tables are used */
+    const unsigned char *   huffman_tables[2][4]; /* in DHT format, by class (DC, AC) and id, NULL when not defined */
+
+    int                     scan_num_components; /* of the first scan */
+    int                     scan_component[JPEG_MAX_COMPONENTS]; /* index in the frame header */
+    int                     scan_dc_table[JPEG_MAX_COMPONENTS];
+    int                     scan_ac_table[JPEG_MAX_COMPONENTS];
+    int                     scan_spectral_end;
+    int                     scan_offset; /* offset of the entropy coded data */
+    int                     scan_len;
+} jpeg_info_t;
+
+typedef struct {
+    int                     state;
+    int                     offs; /* where scanning resumes */
+    int                     start; /* offset of the start of image marker */
+} jpeg_framer_t;
+
+typedef struct {
+    short                   dc; /* quantized */
+    unsigned short          ac_len; /* in bits */
+    unsigned int            ac_offs; /* in bits, into the unstuffed data */
+} jpeg_block_t;
+
+/* the blocks of a frame, located by huffman-decoding its entropy coded data, without ever
+ * dequantizing nor transforming them; only baseline (and extended) huffman coded, 8 bit frames,
+ * with a single interleaved scan, are supported */
+typedef struct {
+    jpeg_info_t             info;
+    int                     mcu_w;
+    int                     mcu_h;
+    int                     mcus_x;
+    int                     mcus_y;
+    int                     blocks_per_mcu;
+    int                     block_component[JPEG_MAX_BLOCKS_PER_MCU]; /* scan component of each block of an MCU */
+
+    unsigned char *         data; /* the entropy coded data, unstuffed */
+    int                     data_len;
+    int                     data_max_len;
+    int *                   restarts; /* data offsets of the restart intervals */
+    int                     num_restarts;
+    int                     max_restarts;
+
+    jpeg_block_t *          blocks;
+    int                     max_blocks;
+    int                     indexed_mcus;
+} jpeg_index_t;
+
+/* the standard huffman tables, in DHT format (16 code counts followed by the symbols) */
+extern const unsigned char  jpeg_std_dc_luminance[];
+extern const unsigned char  jpeg_std_dc_chrominance[];
+extern const unsigned char  jpeg_std_ac_luminance[];
+extern const unsigned char  jpeg_std_ac_chrominance[];
+
+int                         jpeg_parse(const unsigned char *buf, int len, jpeg_info_t *info);
+int                         jpeg_huffman_table_len(const unsigned char *table);
+const char *                jpeg_subsampling_name(jpeg_info_t *info);
+
+void                        jpeg_framer_reset(jpeg_framer_t *framer);
+int                         jpeg_framer_feed(jpeg_framer_t *framer, const unsigned char *buf, int len);
+int                         jpeg_find_separator(const unsigned char *buf, int len, const char *separator,
+                                    int separator_len, int look_behind);
+int                         jpeg_strip_metadata(unsigned char *buf, int len);
+
+const unsigned char *       jpeg_huffman_table(jpeg_info_t *info, int table_class, int id);
+int                         jpeg_index_frame(jpeg_index_t *index, const unsigned char *buf, int len);
+int                         jpeg_index_blocks(jpeg_index_t *index, int num_mcus);
+void                        jpeg_index_free(jpeg_index_t *index);
+
+static inline unsigned int jpeg_peek_bits(const unsigned char *data, unsigned int offs, int n) {
+    const unsigned char *p = data + (offs >> 3);
+    unsigned int word = (unsigned int) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+
+    return (word << (offs & 7)) >> (32 - n); /* n must be at most 24 */
+}
+
+
+#endif /* __JPEG_H */
@@ -0,0 +1,98 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/sockios.h>
+#include <linux/tcp.h>
+
+#include "streameye.h"
+#include "common.h"
+#include "latency.h"
+
+
+/* in live mode, the kernel is told to keep only a small amount of unsent data per client socket,
+ * and frames are skipped for as long as the previous one hasn't been sent out yet; this way,
+ * clients always get the newest frame instead of frames queued behind older ones */
+
+
+    /* locals */
+
+static int live_mode = 0;
+
+
+void set_live_mode(int enabled) {
+    live_mode = enabled;
+}
+
+int get_live_mode() {
+    return live_mode;
+}
+
+int latency_enable(client_t *client) {
+    int lowat = LATENCY_NOTSENT_LOWAT;
+
+    if (setsockopt(client->stream_fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat)) < 0) {
+        ERRNO_CLIENT(client, "setsockopt() failed");
+        return -1;
+    }
+
+    return 0;
+}
+
+int latency_drained(client_t *client) {
+    int unsent;
+
+    if (ioctl(client->stream_fd, SIOCOUTQNSD, &unsent) < 0) {
+        return 1; /* can't tell, don't hold the client back */
+    }
+
+    return unsent == 0;
+}
+
+int latency_get_stats(client_t *client, latency_stats_t *stats) {
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+
+    memset(stats, 0, sizeof(latency_stats_t));
+
+    if (ioctl(client->stream_fd, SIOCOUTQ, &stats->queued) < 0 ||
+            ioctl(client->stream_fd, SIOCOUTQNSD, &stats->unsent) < 0) {
+
+        return -1;
+    }
+
+    memset(&info, 0, sizeof(info));
+    if (getsockopt(client->stream_fd, IPPROTO_TCP, TCP_INFO, &info, &len) < 0) {
+        return -1;
+    }
+
+    /* half a round trip, plus draining the queue at the current delivery rate */
+    stats->lag = info.tcpi_rtt / 2000000.0;
+    if (info.tcpi_delivery_rate) {
+        stats->lag += (double) stats->queued / info.tcpi_delivery_rate;
+    }
+
+    return 0;
+}
@@ -0,0 +1,41 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LATENCY_H
+#define __LATENCY_H
+
+#include "client.h"
+
+#define LATENCY_NOTSENT_LOWAT   16 * 1024 /* bytes */
+
+typedef struct {
+    int             queued; /* bytes in the send queue, either not sent or not acknowledged */
+    int             unsent;
+    double          lag; /* estimated time until the last queued byte reaches the client, in seconds */
+} latency_stats_t;
+
+
+void                set_live_mode(int enabled);
+int                 get_live_mode();
+int                 latency_enable(client_t *client);
+int                 latency_drained(client_t *client);
+int                 latency_get_stats(client_t *client, latency_stats_t *stats);
+
+
+#endif /* __LATENCY_H */
@@ -0,0 +1,209 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <arpa/inet.h>
+#include <linux/sockios.h>
+
+#include "streameye.h"
+#include "common.h"
+#include "auth.h"
+#include "load.h"
+
+
+/* the client threads account for the CPU time their send loops take, and for the frames sent
+ * late: those that take longer to send than the frame interval, or that find the previous ones
+ * still in the socket's send queue, a sign of the socket pushing back. At every frame,
+ * these are compared against the CPU budget and the tolerated share of late frames. While
+ * overloaded, the load level goes up a step at a time: low priority clients first get every
+ * second frame, then every fourth and so on, and are eventually shed, newest first, so that the
+ * high priority ones keep their full frame rate. */
+
+
+    /* locals */
+
+static double budget = 0; /* CPUs, 0 when disabled */
+static pthread_mutex_t load_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static double send_cpu = 0; /* accumulated since the last update */
+static int sends = 0;
+static int sends_behind = 0;
+static double frame_interval = 0;
+
+static double cpu_usage = 0;
+static double behind_ratio = 0;
+static double last_update = 0;
+static double last_step = 0;
+static int level = 0;
+static unsigned int shed_total = 0;
+
+
+    /* local functions */
+
+static void         shed_clients();
+
+
+void load_init(double value) {
+    budget = value;
+    if (budget) {
+        DEBUG("load shedding enabled, with a budget of %.0f%% CPU", budget * 100);
+    }
+}
+
+int load_enabled() {
+    return budget > 0;
+}
+
+double load_cpu_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+void load_account(client_t *client, int size, double cpu_start, double wall_start) {
+    double cpu = load_cpu_time() - cpu_start;
+    double wall = get_now() - wall_start;
+    int unsent = 0, late;
+
+    late = frame_interval && wall > frame_interval;
+    if (size && !late && !ioctl(client->stream_fd, SIOCOUTQNSD, &unsent)) {
+        late = unsent > size;
+    }
+
+    pthread_mutex_lock(&load_mutex);
+    send_cpu += cpu;
+    sends++;
+    if (late) {
+        sends_behind++;
+    }
+    pthread_mutex_unlock(&load_mutex);
+}
+
+void shed_clients() {
+    client_t *client;
+    int i, num_low = 0, num_shed;
+
+    if (pthread_mutex_lock(&clients_mutex)) {
+        ERROR("pthread_mutex_lock() failed");
+        return;
+    }
+
+    for (i = 0; i < num_clients; i++) {
+        if (clients[i]->streaming && !clients[i]->shed && clients[i]->priority < PRIORITY_HIGH) {
+            num_low++;
+        }
+    }
+
+    /* the newest clients come last */
+    num_shed = MAX(1, num_low / LOAD_SHED_FRACTION);
+    for (i = num_clients - 1; i >= 0 && num_shed && num_low; i--) {
+        client = clients[i];
+        if (client->streaming && !client->shed && client->priority < PRIORITY_HIGH) {
+            client->shed = 1;
+            num_shed--;
+            shed_total++;
+        }
+    }
+
+    if (pthread_mutex_unlock(&clients_mutex)) {
+        ERROR("pthread_mutex_unlock() failed");
+    }
+}
+
+void load_update(double frame_int) {
+    /* must be called with the jpeg mutex locked, at every frame */
+    double now = get_now(), elapsed = now - last_update;
+    int overloaded, relieved;
+
+    if (!budget) {
+        return;
+    }
+
+    pthread_mutex_lock(&load_mutex);
+    if (last_update) {
+        cpu_usage = cpu_usage * 0.7 + send_cpu / elapsed * 0.3;
+        if (sends) {
+            behind_ratio = behind_ratio * 0.7 + (double) sends_behind / sends * 0.3;
+        }
+    }
+    send_cpu = 0;
+    sends = 0;
+    sends_behind = 0;
+    frame_interval = frame_int;
+    pthread_mutex_unlock(&load_mutex);
+
+    last_update = now;
+    if (now - last_step < LOAD_STEP_INTERVAL) {
+        return;
+    }
+
+    overloaded = cpu_usage > budget || behind_ratio > LOAD_BEHIND_RATIO;
+    relieved = cpu_usage < budget * LOAD_RECOVER_RATIO && behind_ratio < LOAD_BEHIND_RATIO * LOAD_RECOVER_RATIO;
+
+    if (overloaded) {
+        if (level < LOAD_LEVEL_SHED) {
+            level++;
+            if (level < LOAD_LEVEL_SHED) {
+                INFO("overloaded (%.1f%% CPU, %.0f%% of frames late), low priority clients get one frame in %d",
+                        cpu_usage * 100, behind_ratio * 100, 1 << level);
+            }
+            else {
+                INFO("overloaded (%.1f%% CPU, %.0f%% of frames late), shedding low priority clients",
+                        cpu_usage * 100, behind_ratio * 100);
+            }
+        }
+
+        if (level == LOAD_LEVEL_SHED) {
+            shed_clients();
+        }
+
+        last_step = now;
+    }
+    else if (relieved && level > 0) {
+        level--;
+        INFO("load relieved (%.1f%% CPU, %.0f%% of frames late), low priority clients get one frame in %d",
+                cpu_usage * 100, behind_ratio * 100, 1 << MIN(level, LOAD_MAX_THROTTLE));
+
+        last_step = now;
+    }
+}
+
+int load_skip_frame(client_t *client, unsigned int seq) {
+    if (!level || client->priority >= PRIORITY_HIGH) {
+        return 0;
+    }
+
+    return (seq & ((1 << MIN(level, LOAD_MAX_THROTTLE)) - 1)) != 0;
+}
+
+int load_shedding() {
+    return level == LOAD_LEVEL_SHED;
+}
+
+void load_get_stats(double *cpu, double *behind, int *lvl, unsigned int *shed) {
+    *cpu = cpu_usage;
+    *behind = behind_ratio;
+    *lvl = level;
+    *shed = shed_total;
+}
@@ -0,0 +1,43 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LOAD_H
+#define __LOAD_H
+
+#include "client.h"
+
+#define LOAD_MAX_THROTTLE       3 /* low priority clients get down to one frame in 2^3 before being shed */
+#define LOAD_LEVEL_SHED         (LOAD_MAX_THROTTLE + 1)
+#define LOAD_STEP_INTERVAL      2 /* seconds between two changes of the load level */
+#define LOAD_BEHIND_RATIO       0.25 /* of the frames sent late, above which the egress is saturated */
+#define LOAD_RECOVER_RATIO      0.7 /* of the limits, under which the load level steps down */
+#define LOAD_SHED_FRACTION      4 /* one in this many low priority clients is shed at a time */
+
+
+void                load_init(double budget);
+int                 load_enabled();
+double              load_cpu_time();
+void                load_account(client_t *client, int size, double cpu_start, double wall_start);
+void                load_update(double frame_int);
+int                 load_skip_frame(client_t *client, unsigned int seq);
+int                 load_shedding();
+void                load_get_stats(double *cpu, double *behind, int *level, unsigned int *shed);
+
+
+#endif /* __LOAD_H */
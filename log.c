@@ -0,0 +1,275 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "log.h"
+
+
+/* each thread writes its log messages into its own single-producer ring,
+ * so that logging never blocks on a lock or on stderr;
+ * a background thread drains all the rings and writes the messages out */
+typedef struct log_ring {
+    unsigned int        head; /* written by the producer thread only */
+    unsigned int        tail; /* written by the log thread only */
+    int                 orphaned;
+    struct log_ring *   next;
+    char                msgs[LOG_RING_LEN][LOG_MSG_LEN];
+} log_ring_t;
+
+
+    /* locals */
+
+static log_ring_t *rings = NULL;
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+static pthread_t log_thread;
+static int log_running = 0;
+static unsigned long dropped = 0;
+
+static __thread log_ring_t *thread_ring = NULL;
+static __thread int in_log = 0;
+
+
+    /* local functions */
+
+static void         release_ring(void *ring);
+static log_ring_t * get_thread_ring();
+static int          drain_rings();
+static void *       log_thread_func(void *arg);
+
+
+void release_ring(void *ring) {
+    /* the ring may still hold messages, it's freed by the log thread once drained */
+    __atomic_store_n(&((log_ring_t *) ring)->orphaned, 1, __ATOMIC_RELEASE);
+}
+
+log_ring_t *get_thread_ring() {
+    if (thread_ring) {
+        return thread_ring;
+    }
+
+    log_ring_t *ring = malloc(sizeof(log_ring_t));
+    if (!ring) {
+        return NULL;
+    }
+
+    memset(ring, 0, offsetof(log_ring_t, msgs));
+
+    pthread_mutex_lock(&rings_mutex);
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&rings_mutex);
+
+    pthread_setspecific(ring_key, ring);
+    thread_ring = ring;
+
+    return ring;
+}
+
+int drain_rings() {
+    static char buf[LOG_RING_LEN * LOG_MSG_LEN];
+    static unsigned long reported_dropped = 0;
+    log_ring_t *ring, **prev;
+    unsigned int head, tail;
+    int len, total = 0;
+    unsigned long d;
+
+    pthread_mutex_lock(&rings_mutex);
+
+    prev = &rings;
+    while ((ring = *prev)) {
+        int orphaned = __atomic_load_n(&ring->orphaned, __ATOMIC_ACQUIRE);
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        tail = ring->tail;
+        len = 0;
+
+        while (tail != head) {
+            char *msg = ring->msgs[tail % LOG_RING_LEN];
+            int msg_len = strlen(msg);
+            memcpy(buf + len, msg, msg_len);
+            len += msg_len;
+            tail++;
+        }
+
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+        if (len) {
+            fwrite(buf, 1, len, stderr);
+            total += len;
+        }
+
+        if (orphaned) {
+            *prev = ring->next;
+            free(ring);
+        }
+        else {
+            prev = &ring->next;
+        }
+    }
+
+    pthread_mutex_unlock(&rings_mutex);
+
+    d = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+    if (d != reported_dropped) {
+        fprintf(stderr, "%s: ERROR: %lu log messages dropped\n", str_timestamp(), d - reported_dropped);
+        reported_dropped = d;
+        total++;
+    }
+
+    if (total) {
+        fflush(stderr);
+    }
+
+    return total;
+}
+
+void *log_thread_func(void *arg) {
+    struct timespec ts = {0, LOG_FLUSH_INTERVAL * 1000000L};
+
+    while (__atomic_load_n(&log_running, __ATOMIC_ACQUIRE)) {
+        drain_rings();
+        nanosleep(&ts, NULL);
+    }
+
+    drain_rings();
+
+    return NULL;
+}
+
+
+    /* public interface */
+
+char *str_timestamp() {
+    /* formatting the time is expensive, so it's done at most once per second and thread */
+    static __thread char s[20];
+    static __thread time_t last_t = 0;
+
+    time_t t = time(NULL);
+    if (t != last_t) {
+        struct tm tm;
+        localtime_r(&t, &tm);
+        strftime(s, sizeof(s), "%Y-%m-%d %H:%M:%S", &tm);
+        last_t = t;
+    }
+
+    return s;
+}
+
+void log_start() {
+    if (pthread_key_create(&ring_key, release_ring)) {
+        fprintf(stderr, "%s: ERROR: pthread_key_create() failed\n", str_timestamp());
+        return;
+    }
+
+    log_running = 1;
+    if (pthread_create(&log_thread, NULL, log_thread_func, NULL)) {
+        log_running = 0;
+        fprintf(stderr, "%s: ERROR: pthread_create() failed\n", str_timestamp());
+    }
+}
+
+void log_stop() {
+    if (!log_running) {
+        return;
+    }
+
+    __atomic_store_n(&log_running, 0, __ATOMIC_RELEASE);
+    pthread_join(log_thread, NULL);
+}
+
+void log_message(log_limit_t *limit, const char *level, const char *fmt, ...) {
+    char buf[LOG_MSG_LEN];
+    char *msg;
+    log_ring_t *ring = NULL;
+    va_list ap;
+    int len, reentered;
+
+    if (limit) {
+        time_t t = time(NULL);
+        if (t != limit->window) {
+            if (limit->suppressed) {
+                log_message(NULL, level, "%d messages suppressed", limit->suppressed);
+            }
+
+            limit->window = t;
+            limit->count = 0;
+            limit->suppressed = 0;
+        }
+
+        if (++limit->count > LOG_CLIENT_MAX_RATE) {
+            limit->suppressed++;
+            return;
+        }
+    }
+
+    /* fall back to synchronous logging when the log thread isn't running,
+     * or when reentered from a signal handler */
+    reentered = in_log;
+    in_log = 1;
+
+    if (__atomic_load_n(&log_running, __ATOMIC_ACQUIRE) && !reentered) {
+        ring = get_thread_ring();
+    }
+
+    if (ring) {
+        unsigned int head = ring->head;
+        if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= LOG_RING_LEN) {
+            __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+            in_log = reentered;
+            return;
+        }
+
+        msg = ring->msgs[head % LOG_RING_LEN];
+    }
+    else {
+        msg = buf;
+    }
+
+    len = snprintf(msg, LOG_MSG_LEN, "%s: %s: ", str_timestamp(), level);
+    va_start(ap, fmt);
+    len += vsnprintf(msg + len, LOG_MSG_LEN - len, fmt, ap);
+    va_end(ap);
+
+    /* make sure the message always ends with a new line, even if truncated */
+    len = MIN(len, LOG_MSG_LEN - 2);
+    msg[len] = '\n';
+    msg[len + 1] = 0;
+
+    if (ring) {
+        __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+    }
+    else {
+        fputs(msg, stderr);
+    }
+
+    in_log = reentered;
+}
+
+unsigned long log_get_dropped() {
+    return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,44 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LOG_H
+#define __LOG_H
+
+#include <time.h>
+
+#define LOG_RING_LEN            128 /* messages per thread */
+#define LOG_MSG_LEN             256
+#define LOG_FLUSH_INTERVAL      50 /* milliseconds */
+#define LOG_CLIENT_MAX_RATE     20 /* messages per second, per client */
+
+typedef struct {
+    time_t          window;
+    int             count;
+    int             suppressed;
+} log_limit_t;
+
+
+void                log_start();
+void                log_stop();
+void                log_message(log_limit_t *limit, const char *level, const char *fmt, ...)
+                            __attribute__ ((format (printf, 3, 4)));
+unsigned long       log_get_dropped();
+
+
+#endif /* __LOG_H */
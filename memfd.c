@@ -0,0 +1,308 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+
+#include "streameye.h"
+#include "common.h"
+#include "streameye_memfd.h"
+#include "memfd.h"
+
+
+/* producers pass each frame as a file descriptor (a memfd), along with the offset and length of the frame
+ * in it; the memfd is mapped and the frame is published right from the mapping, with no copy and no need
+ * to look for frame boundaries. Mappings are read-only: a written page of a private mapping would stop
+ * following the producer's writes, so metadata is stripped from a copy instead. A frame is released, by sending its id back, as soon as the next one is published. */
+
+
+typedef struct {
+    char *          addr;
+    size_t          len;
+} mapping_t;
+
+
+    /* locals */
+
+static char *listen_path = NULL;
+static int listen_fd = -1;
+static int producer_fd = -1;
+
+static mapping_t current; /* the mapping of the last memfd received */
+static mapping_t published; /* the mapping holding the published frame */
+static unsigned int received_id;
+static unsigned int published_id;
+static int has_published = 0;
+
+
+    /* local functions */
+
+static int          accept_producer();
+static void         close_producer();
+static int          map_memfd(int fd);
+static void         unmap(mapping_t *mapping);
+static void         release(unsigned int id);
+
+
+int memfd_input_init(char *path) {
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        ERROR("memfd: socket path too long");
+        return -1;
+    }
+
+    listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        ERRNO("socket() failed");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    /* a stale socket (or the one of an instance we're taking over from) is replaced */
+    unlink(path);
+
+    if (bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        ERRNO("bind() failed");
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+
+    if (listen(listen_fd, 1) < 0) {
+        ERRNO("listen() failed");
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+
+    listen_path = strdup(path);
+    INFO("memfd: waiting for producers on %s", path);
+
+    return 0;
+}
+
+int accept_producer() {
+    producer_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (producer_fd < 0) {
+        if (errno != EINTR) {
+            ERRNO("memfd: accept() failed");
+        }
+
+        return -1;
+    }
+
+    INFO("memfd: producer connected");
+
+    return 0;
+}
+
+void close_producer() {
+    close(producer_fd);
+    producer_fd = -1;
+
+    /* frames of another producer won't refer to the memfd of this one */
+    if (current.addr != published.addr) {
+        unmap(&current);
+    }
+    current.addr = NULL;
+    has_published = 0;
+}
+
+int map_memfd(int fd) {
+    struct stat st;
+    int seals = fcntl(fd, F_GET_SEALS);
+
+    /* a memfd that can shrink could leave us with pages that are no longer there,
+     * and one that can be written to could change frames while they're being sent */
+    if (seals < 0 || !(seals & F_SEAL_SHRINK) || !(seals & (F_SEAL_WRITE | F_SEAL_FUTURE_WRITE))) {
+        ERROR("memfd: received file descriptor is not a memfd sealed against shrinking and writing");
+        return -1;
+    }
+
+    if (fstat(fd, &st) < 0) {
+        ERRNO("fstat() failed");
+        return -1;
+    }
+
+    if (current.addr && current.addr != published.addr) {
+        unmap(&current);
+    }
+
+    current.len = st.st_size;
+    current.addr = current.len ? mmap(NULL, current.len, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    if (current.addr == MAP_FAILED) {
+        ERRNO("mmap() failed");
+        current.addr = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+void unmap(mapping_t *mapping) {
+    if (mapping->addr) {
+        munmap(mapping->addr, mapping->len);
+        mapping->addr = NULL;
+    }
+}
+
+void release(unsigned int id) {
+    se_memfd_release_t msg = {SE_MEMFD_MAGIC, id};
+
+    /* producers that don't care about releases simply don't read them */
+    if (producer_fd >= 0) {
+        send(producer_fd, &msg, sizeof(msg), MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+}
+
+int memfd_input_receive(char **buf, int *size) {
+    se_memfd_frame_t frame;
+    char cmsg_buf[CMSG_SPACE(sizeof(int))];
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    int fd, len, r;
+
+    while (1) {
+        /* the signal may have come in between two blocking calls */
+        if (!running) {
+            errno = EINTR;
+            return -1;
+        }
+
+        if (producer_fd < 0 && accept_producer() < 0) {
+            return -1;
+        }
+
+        memset(&msg, 0, sizeof(msg));
+        iov.iov_base = &frame;
+        iov.iov_len = sizeof(frame);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cmsg_buf;
+        msg.msg_controllen = sizeof(cmsg_buf);
+
+        len = recvmsg(producer_fd, &msg, MSG_CMSG_CLOEXEC);
+        if (len < 0) {
+            if (errno == EINTR) {
+                return -1;
+            }
+
+            ERRNO("memfd: recvmsg() failed");
+            close_producer();
+            continue;
+        }
+        else if (len == 0) {
+            INFO("memfd: producer disconnected");
+            close_producer();
+            continue;
+        }
+
+        fd = -1;
+        cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+
+        if (len != sizeof(frame) || frame.magic != SE_MEMFD_MAGIC || (msg.msg_flags & MSG_CTRUNC)) {
+            ERROR("memfd: invalid message from producer");
+            if (fd >= 0) {
+                close(fd);
+            }
+            close_producer();
+            continue;
+        }
+
+        if (fd >= 0) {
+            /* the mapping keeps the memory around, the file descriptor isn't needed anymore */
+            r = map_memfd(fd);
+            close(fd);
+            if (r < 0) {
+                release(frame.id);
+                continue;
+            }
+        }
+
+        if (!current.addr || frame.len == 0 || frame.len > JPEG_BUF_LEN ||
+            frame.offset > current.len || frame.len > current.len - frame.offset) {
+
+            ERROR("memfd: invalid frame (offset %llu, length %llu)",
+                    (unsigned long long) frame.offset, (unsigned long long) frame.len);
+            release(frame.id);
+            continue;
+        }
+
+        received_id = frame.id;
+        *buf = current.addr + frame.offset;
+        *size = frame.len;
+
+        return 1;
+    }
+}
+
+void memfd_input_done() {
+    /* must be called with the jpeg mutex locked, right after publishing
+     * the frame received last; the previous one is no longer referenced */
+    if (published.addr && published.addr != current.addr) {
+        unmap(&published);
+    }
+    if (has_published) {
+        release(published_id);
+    }
+
+    published = current;
+    published_id = received_id;
+    has_published = 1;
+}
+
+void memfd_input_stop(int unlink_path) {
+    if (listen_fd < 0) {
+        return;
+    }
+
+    if (producer_fd >= 0) {
+        close(producer_fd);
+        producer_fd = -1;
+    }
+
+    close(listen_fd);
+    listen_fd = -1;
+
+    /* the socket now belongs to the new instance, after a hand-off */
+    if (unlink_path) {
+        unlink(listen_path);
+    }
+
+    free(listen_path);
+    listen_path = NULL;
+}
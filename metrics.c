@@ -0,0 +1,208 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <arpa/inet.h>
+
+#include "streameye.h"
+#include "common.h"
+#include "metrics.h"
+#include "latency.h"
+#include "motion.h"
+#include "load.h"
+
+
+/* a plain text snapshot of the server state, in the Prometheus exposition format */
+
+const char *RESPONSE_METRICS_HEADER_TEMPLATE =
+        "HTTP/1.1 200 OK\r\n"
+        "Server: streamEye/%s\r\n"
+        "Connection: close\r\n"
+        "Cache-Control: no-cache, private\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: %d\r\n"
+        "\r\n";
+
+
+    /* locals */
+
+static unsigned long long stripped_bytes = 0;
+
+
+    /* local functions */
+
+static int          append(char *buf, int len, const char *fmt, ...);
+static int          append_clients(char *buf, int len);
+
+
+int is_metrics_uri(const char *uri) {
+    int len = strlen(METRICS_URI);
+
+    return !strncmp(uri, METRICS_URI, len) && (!uri[len] || uri[len] == '?');
+}
+
+int is_metrics_request(client_t *client) {
+    return is_metrics_uri(client->uri);
+}
+
+void metrics_count_stripped(int bytes) {
+    stripped_bytes += bytes;
+}
+
+int append(char *buf, int len, const char *fmt, ...) {
+    va_list args;
+    int r;
+
+    if (len >= METRICS_BUF_LEN) {
+        return len;
+    }
+
+    va_start(args, fmt);
+    r = vsnprintf(buf + len, METRICS_BUF_LEN - len, fmt, args);
+    va_end(args);
+
+    return MIN(len + r, METRICS_BUF_LEN);
+}
+
+int append_clients(char *buf, int len) {
+    latency_stats_t stats;
+    client_t *client;
+    char label[INET_ADDRSTRLEN + 16];
+    int i;
+
+    if (pthread_mutex_lock(&clients_mutex)) {
+        ERROR("pthread_mutex_lock() failed");
+        return len;
+    }
+
+    len = append(buf, len, "# TYPE streameye_client_frames_sent_total counter\n");
+    len = append(buf, len, "# TYPE streameye_client_frames_skipped_total counter\n");
+    len = append(buf, len, "# TYPE streameye_client_queued_bytes gauge\n");
+    len = append(buf, len, "# TYPE streameye_client_unsent_bytes gauge\n");
+    len = append(buf, len, "# TYPE streameye_client_lag_seconds gauge\n");
+    len = append(buf, len, "# TYPE streameye_client_jitter_seconds gauge\n");
+    len = append(buf, len, "# TYPE streameye_client_jitter_max_seconds gauge\n");
+
+    for (i = 0; i < num_clients; i++) {
+        client = clients[i];
+        if (!client->streaming) {
+            continue;
+        }
+
+        snprintf(label, sizeof(label), "%s:%d", client->addr, client->port);
+        len = append(buf, len, "streameye_client_frames_sent_total{client=\"%s\"} %u\n", label, client->frames_sent);
+        len = append(buf, len, "streameye_client_frames_skipped_total{client=\"%s\"} %u\n", label,
+                client->frames_skipped);
+        len = append(buf, len, "streameye_client_jitter_seconds{client=\"%s\"} %.6f\n", label,
+                client->delivery_jitter);
+        len = append(buf, len, "streameye_client_jitter_max_seconds{client=\"%s\"} %.6f\n", label,
+                client->delivery_jitter_max);
+
+        if (latency_get_stats(client, &stats) < 0) {
+            continue;
+        }
+
+        len = append(buf, len, "streameye_client_queued_bytes{client=\"%s\"} %d\n", label, stats.queued);
+        len = append(buf, len, "streameye_client_unsent_bytes{client=\"%s\"} %d\n", label, stats.unsent);
+        len = append(buf, len, "streameye_client_lag_seconds{client=\"%s\"} %.3f\n", label, stats.lag);
+    }
+
+    if (pthread_mutex_unlock(&clients_mutex)) {
+        ERROR("pthread_mutex_unlock() failed");
+    }
+
+    return len;
+}
+
+int metrics_format(char *buf) {
+    int len = 0;
+    unsigned int analyzed, dropped, shed;
+    double cpu, behind, motion;
+    int level;
+
+    if (pthread_mutex_lock(&jpeg_mutex)) {
+        ERROR("pthread_mutex_lock() failed");
+        return 0;
+    }
+
+    len = append(buf, len, "# TYPE streameye_frames_total counter\n");
+    len = append(buf, len, "streameye_frames_total %u\n", jpeg_seq);
+    len = append(buf, len, "# TYPE streameye_frame_bytes gauge\n");
+    len = append(buf, len, "streameye_frame_bytes %d\n", jpeg_seq ? jpeg_size : 0);
+    len = append(buf, len, "# TYPE streameye_frame_width gauge\n");
+    len = append(buf, len, "streameye_frame_width %d\n", jpeg_width);
+    len = append(buf, len, "# TYPE streameye_frame_height gauge\n");
+    len = append(buf, len, "streameye_frame_height %d\n", jpeg_height);
+    len = append(buf, len, "# TYPE streameye_frame_info gauge\n");
+    len = append(buf, len, "streameye_frame_info{subsampling=\"%s\"} 1\n", jpeg_subsampling);
+    len = append(buf, len, "# TYPE streameye_input_jitter_seconds gauge\n");
+    len = append(buf, len, "streameye_input_jitter_seconds %.6f\n", get_input_jitter());
+    if (motion_enabled()) {
+        motion_get_stats(&motion, &analyzed, &dropped);
+        len = append(buf, len, "# TYPE streameye_motion_score gauge\n");
+        len = append(buf, len, "streameye_motion_score %.1f\n", motion);
+        len = append(buf, len, "# TYPE streameye_motion_frames_analyzed_total counter\n");
+        len = append(buf, len, "streameye_motion_frames_analyzed_total %u\n", analyzed);
+        len = append(buf, len, "# TYPE streameye_motion_frames_dropped_total counter\n");
+        len = append(buf, len, "streameye_motion_frames_dropped_total %u\n", dropped);
+    }
+    if (load_enabled()) {
+        load_get_stats(&cpu, &behind, &level, &shed);
+        len = append(buf, len, "# TYPE streameye_load_send_cpu_ratio gauge\n");
+        len = append(buf, len, "streameye_load_send_cpu_ratio %.3f\n", cpu);
+        len = append(buf, len, "# TYPE streameye_load_late_frames_ratio gauge\n");
+        len = append(buf, len, "streameye_load_late_frames_ratio %.3f\n", behind);
+        len = append(buf, len, "# TYPE streameye_load_level gauge\n");
+        len = append(buf, len, "streameye_load_level %d\n", level);
+        len = append(buf, len, "# TYPE streameye_load_shed_clients_total counter\n");
+        len = append(buf, len, "streameye_load_shed_clients_total %u\n", shed);
+    }
+    len = append(buf, len, "# TYPE streameye_stripped_bytes_total counter\n");
+    len = append(buf, len, "streameye_stripped_bytes_total %llu\n", stripped_bytes);
+
+    if (pthread_mutex_unlock(&jpeg_mutex)) {
+        ERROR("pthread_mutex_unlock() failed");
+    }
+
+    len = append(buf, len, "# TYPE streameye_clients gauge\n");
+    len = append(buf, len, "streameye_clients %d\n", num_clients);
+    len = append_clients(buf, len);
+    len = append(buf, len, "# TYPE streameye_log_dropped_total counter\n");
+    len = append(buf, len, "streameye_log_dropped_total %lu\n", log_get_dropped());
+
+    return len;
+}
+
+int metrics_write(client_t *client) {
+    char *buf = malloc(METRICS_BUF_LEN);
+    char header[256];
+    int len = metrics_format(buf), r;
+
+    snprintf(header, sizeof(header), RESPONSE_METRICS_HEADER_TEMPLATE, STREAM_EYE_VERSION, len);
+    r = write_to_client(client, header, strlen(header));
+    if (r > 0) {
+        r = write_to_client(client, buf, len);
+    }
+
+    free(buf);
+
+    return r;
+}
@@ -0,0 +1,36 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __METRICS_H
+#define __METRICS_H
+
+#include "client.h"
+
+#define METRICS_URI             "/metrics"
+#define METRICS_BUF_LEN         64 * 1024
+
+
+int                 is_metrics_uri(const char *uri);
+int                 is_metrics_request(client_t *client);
+int                 metrics_format(char *buf);
+int                 metrics_write(client_t *client);
+void                metrics_count_stripped(int bytes);
+
+
+#endif /* __METRICS_H */
@@ -0,0 +1,334 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "streameye.h"
+#include "common.h"
+#include "jpeg.h"
+#include "motion.h"
+
+
+/* frames are scored for motion without being decoded: the entropy coded data is only
+ * huffman-decoded, and the DC coefficients of the luminance blocks give the average brightness
+ * of each MCU, a grid of (usually) 16x16 pixel cells. The score is the percentage of cells whose
+ * brightness changed noticeably since the previously analyzed frame. Frames are analyzed by a
+ * thread of their own; one that comes while the previous is still being analyzed is not. Scores
+ * are kept along with the sequence number of their frame, so that a frame is never presented
+ * with the score of another; frames that weren't analyzed have no score. */
+
+
+typedef struct {
+    unsigned int    seq;
+    double          score;
+} motion_entry_t;
+
+
+    /* locals */
+
+static int started = 0;
+static int stopping = 0;
+static pthread_t thread;
+static pthread_mutex_t motion_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t motion_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t score_cond = PTHREAD_COND_INITIALIZER;
+
+/* the frame handed over to the analysis thread, and the one it works on */
+static char *pending_buf = NULL;
+static int pending_size = 0;
+static int pending_max_size = 0;
+static unsigned int pending_seq = 0;
+static int pending = 0;
+static int busy = 0;
+static char *work_buf = NULL;
+static int work_max_size = 0;
+static unsigned int work_seq = 0;
+
+static motion_entry_t history[MOTION_HISTORY_LEN]; /* sequence numbers start at 1 */
+static int history_next = 0;
+static double score = 0;
+static unsigned int analyzed = 0;
+static unsigned int dropped = 0;
+
+/* owned by the analysis thread */
+static jpeg_index_t frame_index;
+static int *grid = NULL; /* 8 times the average luminance of each cell */
+static int *prev_grid = NULL;
+static int num_cells = 0;
+static int prev_num_cells = 0;
+static int max_cells = 0;
+static int failing = 0;
+
+
+    /* local functions */
+
+static int          analyze(const unsigned char *buf, int size, double *result);
+static void *       run(void *arg);
+static double       lookup(unsigned int seq);
+
+
+int analyze(const unsigned char *buf, int size, double *result) {
+    jpeg_info_t *info = &frame_index.info;
+    const unsigned char *qtable;
+    jpeg_block_t *block;
+    int *tmp;
+    int m, b, c, n, q, sum, changed;
+
+    if (jpeg_index_frame(&frame_index, buf, size) < 0) {
+        return -1;
+    }
+
+    num_cells = frame_index.mcus_x * frame_index.mcus_y;
+    if (jpeg_index_blocks(&frame_index, num_cells) < 0) {
+        return -1;
+    }
+
+    /* the DC coefficient is 8 times the average of the block, level shifted, once dequantized */
+    c = info->scan_component[0];
+    qtable = info->qtables[info->tq[c]];
+    if (!qtable) {
+        return -1;
+    }
+    q = info->qtable_precision[info->tq[c]] ? qtable[0] << 8 | qtable[1] : qtable[0];
+
+    if (num_cells > max_cells) {
+        max_cells = num_cells;
+        grid = realloc(grid, sizeof(int) * max_cells);
+        prev_grid = realloc(prev_grid, sizeof(int) * max_cells);
+    }
+
+    for (b = 0, n = 0; b < frame_index.blocks_per_mcu; b++) {
+        n += frame_index.block_component[b] == 0;
+    }
+
+    block = frame_index.blocks;
+    changed = 0;
+    for (m = 0; m < num_cells; m++) {
+        for (b = 0, sum = 0; b < frame_index.blocks_per_mcu; b++, block++) {
+            if (frame_index.block_component[b] == 0) {
+                sum += block->dc;
+            }
+        }
+
+        grid[m] = 1024 + sum * q / n;
+        if (num_cells == prev_num_cells && abs(grid[m] - prev_grid[m]) > 8 * MOTION_CELL_DELTA) {
+            changed++;
+        }
+    }
+
+    /* the first frame, or one of a different size, has nothing to be compared against */
+    *result = num_cells == prev_num_cells ? 100.0 * changed / num_cells : 0;
+
+    tmp = prev_grid;
+    prev_grid = grid;
+    grid = tmp;
+    prev_num_cells = num_cells;
+
+    return 0;
+}
+
+void *run(void *arg) {
+    char *tmp_buf;
+    int tmp_max_size, size, r;
+    double result;
+
+    pthread_mutex_lock(&motion_mutex);
+
+    while (1) {
+        while (!pending && !stopping) {
+            pthread_cond_wait(&motion_cond, &motion_mutex);
+        }
+
+        if (stopping) {
+            break;
+        }
+
+        /* take the pending frame, leaving our previous buffer in its place */
+        tmp_buf = work_buf;
+        tmp_max_size = work_max_size;
+        work_buf = pending_buf;
+        work_max_size = pending_max_size;
+        pending_buf = tmp_buf;
+        pending_max_size = tmp_max_size;
+        size = pending_size;
+        work_seq = pending_seq;
+        pending = 0;
+        busy = 1;
+
+        pthread_mutex_unlock(&motion_mutex);
+
+        r = analyze((unsigned char *) work_buf, size, &result);
+
+        pthread_mutex_lock(&motion_mutex);
+
+        busy = 0;
+        pthread_cond_broadcast(&score_cond);
+        if (r < 0) {
+            if (!failing) {
+                ERROR("motion: frame can't be analyzed");
+            }
+            failing = 1;
+            continue;
+        }
+
+        failing = 0;
+        score = result;
+        history[history_next].seq = work_seq;
+        history[history_next].score = result;
+        history_next = (history_next + 1) % MOTION_HISTORY_LEN;
+        analyzed++;
+        DEBUG("motion: frame %u score %.1f", work_seq, score);
+    }
+
+    pthread_mutex_unlock(&motion_mutex);
+
+    return NULL;
+}
+
+int motion_init(int enable) {
+    if (!enable) {
+        return 0;
+    }
+
+    if (pthread_create(&thread, NULL, run, NULL)) {
+        ERROR("pthread_create() failed");
+        return -1;
+    }
+
+    started = 1;
+    INFO("motion analysis enabled");
+
+    return 0;
+}
+
+int motion_enabled() {
+    return started;
+}
+
+void motion_publish(char *buf, int size, unsigned int seq) {
+    /* must be called with the jpeg mutex locked */
+    if (!started) {
+        return;
+    }
+
+    /* the analysis thread holds the lock only while swapping buffers, so this never waits for long */
+    if (pthread_mutex_lock(&motion_mutex)) {
+        ERROR("pthread_mutex_lock() failed");
+        return;
+    }
+
+    if (busy || pending) {
+        /* the frame is dropped rather than queued; input never waits for the analysis */
+        dropped++;
+    }
+    else {
+        if (size > pending_max_size) {
+            pending_max_size = size;
+            pending_buf = realloc(pending_buf, pending_max_size);
+        }
+
+        memcpy(pending_buf, buf, size);
+        pending_size = size;
+        pending_seq = seq;
+        pending = 1;
+        pthread_cond_signal(&motion_cond);
+    }
+
+    pthread_mutex_unlock(&motion_mutex);
+}
+
+double lookup(unsigned int seq) {
+    /* must be called with the motion mutex locked */
+    int i;
+
+    for (i = 0; i < MOTION_HISTORY_LEN; i++) {
+        if (history[i].seq == seq) {
+            return history[i].score;
+        }
+    }
+
+    return -1;
+}
+
+double motion_score(unsigned int seq) {
+    /* the score of the given frame, -1 if it wasn't analyzed (or not yet) */
+    double value;
+
+    if (!started) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&motion_mutex);
+    value = lookup(seq);
+    pthread_mutex_unlock(&motion_mutex);
+
+    return value;
+}
+
+double motion_wait_score(unsigned int seq) {
+    /* like motion_score(), but waits for the frame if it's being analyzed or next in line,
+     * which takes no more than the analysis of two frames */
+    double value;
+
+    if (!started) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&motion_mutex);
+    while (!stopping && ((pending && pending_seq == seq) || (busy && work_seq == seq))) {
+        pthread_cond_wait(&score_cond, &motion_mutex);
+    }
+    value = lookup(seq);
+    pthread_mutex_unlock(&motion_mutex);
+
+    return value;
+}
+
+void motion_get_stats(double *last_score, unsigned int *frames_analyzed, unsigned int *frames_dropped) {
+    pthread_mutex_lock(&motion_mutex);
+    *last_score = score;
+    *frames_analyzed = analyzed;
+    *frames_dropped = dropped;
+    pthread_mutex_unlock(&motion_mutex);
+}
+
+void motion_stop() {
+    if (!started) {
+        return;
+    }
+
+    pthread_mutex_lock(&motion_mutex);
+    stopping = 1;
+    pthread_cond_signal(&motion_cond);
+    pthread_cond_broadcast(&score_cond);
+    pthread_mutex_unlock(&motion_mutex);
+
+    pthread_join(thread, NULL);
+    started = 0;
+
+    jpeg_index_free(&frame_index);
+    free(pending_buf);
+    free(work_buf);
+    free(grid);
+    free(prev_grid);
+}
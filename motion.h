@@ -0,0 +1,36 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MOTION_H
+#define __MOTION_H
+
+#define MOTION_CELL_DELTA       8 /* levels of luminance a cell has to change by to count as changed */
+#define MOTION_HISTORY_LEN      16 /* recent frames whose scores are kept */
+
+
+int                 motion_init(int enable);
+int                 motion_enabled();
+void                motion_publish(char *buf, int size, unsigned int seq);
+double              motion_score(unsigned int seq);
+double              motion_wait_score(unsigned int seq);
+void                motion_get_stats(double *last_score, unsigned int *analyzed, unsigned int *dropped);
+void                motion_stop();
+
+
+#endif /* __MOTION_H */
@@ -0,0 +1,139 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "ratelimit.h"
+
+
+    /* locals */
+
+static double client_rate = 0;
+static rate_limiter_t total_limiter;
+static pthread_mutex_t total_limiter_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+    /* local functions */
+
+static void         refill(rate_limiter_t *limiter, double now);
+static int          has_tokens(rate_limiter_t *limiter);
+
+
+void set_rate_limits(double c_rate, double t_rate) {
+    DEBUG("setting rate limits to %.0lf B/s per client, %.0lf B/s in total", c_rate, t_rate);
+
+    client_rate = c_rate;
+    rate_limiter_init(&total_limiter, t_rate);
+}
+
+double get_client_rate_limit() {
+    return client_rate;
+}
+
+double get_total_rate_limit() {
+    return total_limiter.rate;
+}
+
+double parse_rate(char *str) {
+    char *err = NULL;
+    double rate = strtod(str, &err);
+
+    switch (*err) {
+        case 'k':
+        case 'K':
+            rate *= 1024;
+            err++;
+            break;
+
+        case 'm':
+        case 'M':
+            rate *= 1024 * 1024;
+            err++;
+            break;
+    }
+
+    if (*err != 0 || err == str || rate < 0) {
+        return -1;
+    }
+
+    return rate;
+}
+
+
+    /* token bucket */
+
+void rate_limiter_init(rate_limiter_t *limiter, double rate) {
+    limiter->rate = rate;
+    limiter->tokens = rate * RATE_BURST_INTERVAL;
+    limiter->last_time = get_now();
+}
+
+void refill(rate_limiter_t *limiter, double now) {
+    limiter->tokens += (now - limiter->last_time) * limiter->rate;
+    limiter->tokens = MIN(limiter->tokens, limiter->rate * RATE_BURST_INTERVAL);
+    limiter->last_time = now;
+}
+
+int has_tokens(rate_limiter_t *limiter) {
+    /* frames are never split, so a frame may be sent as long as the bucket isn't empty;
+     * the bucket then goes into debt, which delays the next frame accordingly */
+    return !limiter->rate || limiter->tokens >= 0;
+}
+
+int rate_limiter_consume(rate_limiter_t *limiter, int size) {
+    double now = get_now();
+    int allowed;
+
+    if (limiter->rate) {
+        refill(limiter, now);
+        if (!has_tokens(limiter)) {
+            return 0;
+        }
+    }
+
+    if (total_limiter.rate) {
+        if (pthread_mutex_lock(&total_limiter_mutex)) {
+            ERROR("pthread_mutex_lock() failed");
+        }
+
+        refill(&total_limiter, now);
+        allowed = has_tokens(&total_limiter);
+        if (allowed) {
+            total_limiter.tokens -= size;
+        }
+
+        if (pthread_mutex_unlock(&total_limiter_mutex)) {
+            ERROR("pthread_mutex_unlock() failed");
+        }
+
+        if (!allowed) {
+            return 0;
+        }
+    }
+
+    if (limiter->rate) {
+        limiter->tokens -= size;
+    }
+
+    return 1;
+}
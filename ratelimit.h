@@ -0,0 +1,43 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __RATELIMIT_H
+#define __RATELIMIT_H
+
+/* the amount of data that may be sent back-to-back after an idle period,
+ * expressed in seconds worth of traffic at the configured rate */
+#define RATE_BURST_INTERVAL     0.25
+
+typedef struct {
+    double          rate; /* bytes per second, 0 means unlimited */
+    double          tokens;
+    double          last_time;
+} rate_limiter_t;
+
+
+void                set_rate_limits(double client_rate, double total_rate);
+double              get_client_rate_limit();
+double              get_total_rate_limit();
+double              parse_rate(char *str);
+
+void                rate_limiter_init(rate_limiter_t *limiter, double rate);
+int                 rate_limiter_consume(rate_limiter_t *limiter, int size);
+
+
+#endif /* __RATELIMIT_H */
@@ -0,0 +1,219 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+
+#include "streameye.h"
+#include "common.h"
+#include "realtime.h"
+
+
+/* in real-time mode, the input thread and the threads serving clients are pinned to CPUs of their
+ * own and may run with the SCHED_FIFO policy, so that a busy machine doesn't get to delay frames;
+ * memory is locked, so that no page fault gets in the way either. The input thread (the highest
+ * priority) paces itself against absolute CLOCK_MONOTONIC deadlines. */
+
+
+    /* locals */
+
+static int enabled = 0;
+static cpu_set_t cpus[2]; /* by role */
+static int priority = 0; /* 0 for the normal scheduling policy */
+static int warned = 0;
+
+
+    /* local functions */
+
+static int          parse_cpus(char *str, cpu_set_t *set);
+
+
+int parse_cpus(char *str, cpu_set_t *set) {
+    char *end;
+    long first, last;
+
+    CPU_ZERO(set);
+
+    /* a list of CPUs and ranges, e.g. 2,4-7 */
+    while (*str) {
+        first = last = strtol(str, &end, 10);
+        if (end == str || first < 0) {
+            return -1;
+        }
+
+        if (*end == '-') {
+            str = end + 1;
+            last = strtol(str, &end, 10);
+            if (end == str || last < first) {
+                return -1;
+            }
+        }
+
+        if (last >= CPU_SETSIZE) {
+            return -1;
+        }
+
+        for (; first <= last; first++) {
+            CPU_SET(first, set);
+        }
+
+        if (*end == ',') {
+            end++;
+        }
+        else if (*end) {
+            return -1;
+        }
+
+        str = end;
+    }
+
+    return CPU_COUNT(set) ? 0 : -1;
+}
+
+int realtime_init(char *spec) {
+    char *str = strdup(spec), *prio, *clients;
+    int flags = MCL_CURRENT | MCL_FUTURE, r = -1, i;
+    cpu_set_t allowed, available;
+
+    /* input_cpus[/client_cpus][:priority] */
+    prio = strchr(str, ':');
+    if (prio) {
+        *prio++ = 0;
+        priority = strtol(prio, &clients, 10);
+        if (*clients || priority < sched_get_priority_min(SCHED_FIFO) + 1 ||
+            priority > sched_get_priority_max(SCHED_FIFO)) {
+
+            goto done;
+        }
+    }
+
+    clients = strchr(str, '/');
+    if (clients) {
+        *clients++ = 0;
+    }
+
+    if (parse_cpus(str, &cpus[REALTIME_INPUT]) < 0 ||
+        parse_cpus(clients ? clients : str, &cpus[REALTIME_CLIENTS]) < 0) {
+
+        goto done;
+    }
+
+    /* CPUs that aren't available would only be found out by the first client */
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) == 0) {
+        for (i = 0; i < 2; i++) {
+            CPU_AND(&available, &cpus[i], &allowed);
+            if (!CPU_EQUAL(&available, &cpus[i])) {
+                ERROR("some of the CPUs given are not available");
+                goto done;
+            }
+        }
+    }
+
+    enabled = 1;
+    r = 0;
+
+#ifdef MCL_ONFAULT
+    /* thread stacks are locked as they're used, rather than all at once */
+    flags |= MCL_ONFAULT;
+#endif
+
+    if (mlockall(flags) < 0) {
+        ERRNO("mlockall() failed");
+    }
+
+    realtime_thread(REALTIME_INPUT);
+
+done:
+    free(str);
+
+    return r;
+}
+
+int realtime_enabled() {
+    return enabled;
+}
+
+void realtime_prefault(void *buf, int len) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    volatile char *p = buf;
+    int i;
+
+    if (!enabled) {
+        return;
+    }
+
+    /* with MCL_ONFAULT, pages are only locked once touched */
+    for (i = 0; i < len; i += page_size) {
+        p[i] = p[i];
+    }
+}
+
+void realtime_thread(int role) {
+    struct sched_param param;
+    int r;
+
+    if (!enabled) {
+        return;
+    }
+
+    r = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus[role]);
+    if (r && !warned) {
+        errno = r;
+        ERRNO("pthread_setaffinity_np() failed");
+        warned = 1;
+    }
+
+    if (!priority) {
+        return;
+    }
+
+    /* clients come second to the input, in case they share CPUs */
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = role == REALTIME_INPUT ? priority : priority - 1;
+    r = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (r && !warned) {
+        errno = r;
+        ERRNO("pthread_setschedparam() failed");
+        warned = 1;
+    }
+}
+
+void realtime_sleep_until(double deadline) {
+    struct timespec ts;
+
+    ts.tv_sec = deadline;
+    ts.tv_nsec = (deadline - ts.tv_sec) * 1e9;
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && running) {
+    }
+}
+
+double update_jitter(double jitter, double interval, double expected) {
+    double deviation = interval > expected ? interval - expected : expected - interval;
+
+    return jitter + (deviation - jitter) / JITTER_GAIN;
+}
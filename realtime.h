@@ -0,0 +1,37 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __REALTIME_H
+#define __REALTIME_H
+
+#define REALTIME_INPUT          0 /* the main thread, reading the input and publishing frames */
+#define REALTIME_CLIENTS        1 /* the threads serving clients */
+
+#define JITTER_GAIN             16.0 /* as in RFC 3550 */
+
+
+int                 realtime_init(char *spec);
+int                 realtime_enabled();
+void                realtime_prefault(void *buf, int len);
+void                realtime_thread(int role);
+void                realtime_sleep_until(double deadline);
+double              update_jitter(double jitter, double interval, double expected);
+
+
+#endif /* __REALTIME_H */
@@ -0,0 +1,383 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "streameye.h"
+#include "common.h"
+#include "jpeg.h"
+#include "rtp.h"
+
+
+/* RTP/JPEG packetization, as described by RFC 2435; the frame headers are not transmitted,
+ * receivers rebuild them from the main JPEG header, using the standard huffman tables */
+
+#define RTP_HEADER_LEN          12
+#define RTP_JPEG_HEADER_LEN     8
+#define RTP_RESTART_HEADER_LEN  4
+#define RTP_QTABLE_HEADER_LEN   4
+#define RTP_MAX_HEADER_LEN      (RTP_HEADER_LEN + RTP_JPEG_HEADER_LEN + RTP_RESTART_HEADER_LEN + \
+                                 RTP_QTABLE_HEADER_LEN + 128)
+
+typedef struct {
+    unsigned char   header[RTP_MAX_HEADER_LEN];
+    struct iovec    iov[2];
+} rtp_packet_t;
+
+
+    /* locals */
+
+static int rtp_fd = -1;
+static struct sockaddr_in rtp_addr;
+static pthread_t rtp_thread;
+static pthread_mutex_t rtp_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rtp_cond = PTHREAD_COND_INITIALIZER;
+static int rtp_running = 0;
+
+static char *rtp_buf = NULL;
+static int rtp_buf_size = 0;
+static double rtp_timestamp = 0;
+static int rtp_ready = 0;
+
+static uint16_t rtp_seq = 0;
+static uint32_t rtp_ssrc = 0;
+static double rtp_frame_int = 0;
+static double rtp_last_frame_time = 0;
+
+
+    /* local functions */
+
+static int          send_frame(unsigned char *buf, int size, double timestamp);
+static void         send_paced(struct mmsghdr *msgs, int num_packets);
+static void *       rtp_thread_func(void *arg);
+
+
+int rtp_init(char *spec) {
+    char group[INET_ADDRSTRLEN];
+    char iface[INET_ADDRSTRLEN] = "";
+    int port = 0;
+    unsigned char ttl = DEF_RTP_TTL, loop = 1;
+
+    if (sscanf(spec, "%15[^:]:%d:%15s", group, &port, iface) < 2 || port <= 0 || port > 65535) {
+        ERROR("invalid multicast address \"%s\"", spec);
+        return -1;
+    }
+
+    memset(&rtp_addr, 0, sizeof(rtp_addr));
+    rtp_addr.sin_family = AF_INET;
+    rtp_addr.sin_port = htons(port);
+    if (!inet_aton(group, &rtp_addr.sin_addr) || !IN_MULTICAST(ntohl(rtp_addr.sin_addr.s_addr))) {
+        ERROR("invalid multicast group \"%s\"", group);
+        return -1;
+    }
+
+    rtp_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (rtp_fd < 0) {
+        ERRNO("socket() failed");
+        return -1;
+    }
+
+    setsockopt(rtp_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    setsockopt(rtp_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+
+    if (iface[0]) {
+        struct in_addr iface_addr;
+        if (!inet_aton(iface, &iface_addr)) {
+            ERROR("invalid multicast interface address \"%s\"", iface);
+            close(rtp_fd);
+            return -1;
+        }
+
+        if (setsockopt(rtp_fd, IPPROTO_IP, IP_MULTICAST_IF, &iface_addr, sizeof(iface_addr)) < 0) {
+            ERRNO("setsockopt() failed");
+            close(rtp_fd);
+            return -1;
+        }
+    }
+
+    rtp_buf = malloc(JPEG_BUF_LEN);
+    if (!rtp_buf) {
+        ERROR("malloc() failed");
+        close(rtp_fd);
+        return -1;
+    }
+
+    srandom(time(NULL) ^ getpid());
+    rtp_ssrc = random();
+    rtp_seq = random();
+
+    rtp_running = 1;
+    if (pthread_create(&rtp_thread, NULL, rtp_thread_func, NULL)) {
+        ERROR("pthread_create() failed");
+        rtp_running = 0;
+        close(rtp_fd);
+        return -1;
+    }
+
+    INFO("sending rtp/jpeg to %s:%d", group, port);
+
+    return 0;
+}
+
+void rtp_publish(char *buf, int size, double timestamp) {
+    if (!rtp_running) {
+        return;
+    }
+
+    if (pthread_mutex_lock(&rtp_mutex)) {
+        ERROR("pthread_mutex_lock() failed");
+        return;
+    }
+
+    /* a frame is sent at once to all receivers; when the previous one
+     * is still being sent, we simply skip this one */
+    if (!rtp_ready) {
+        memcpy(rtp_buf, buf, size);
+        rtp_buf_size = size;
+        rtp_timestamp = timestamp;
+        rtp_ready = 1;
+        pthread_cond_signal(&rtp_cond);
+    }
+    else {
+        DEBUG("rtp: sender busy, skipping frame");
+    }
+
+    if (pthread_mutex_unlock(&rtp_mutex)) {
+        ERROR("pthread_mutex_unlock() failed");
+    }
+}
+
+void rtp_stop() {
+    if (!rtp_running) {
+        return;
+    }
+
+    pthread_mutex_lock(&rtp_mutex);
+    rtp_running = 0;
+    pthread_cond_signal(&rtp_cond);
+    pthread_mutex_unlock(&rtp_mutex);
+
+    pthread_join(rtp_thread, NULL);
+    close(rtp_fd);
+    free(rtp_buf);
+}
+
+void *rtp_thread_func(void *arg) {
+    while (1) {
+        pthread_mutex_lock(&rtp_mutex);
+        while (!rtp_ready && rtp_running) {
+            pthread_cond_wait(&rtp_cond, &rtp_mutex);
+        }
+        pthread_mutex_unlock(&rtp_mutex);
+
+        if (!rtp_running) {
+            break;
+        }
+
+        /* the buffer is not touched by the publisher until the ready flag is cleared */
+        double now = get_now();
+        if (rtp_last_frame_time) {
+            rtp_frame_int = rtp_frame_int * 0.7 + (now - rtp_last_frame_time) * 0.3;
+        }
+        rtp_last_frame_time = now;
+
+        send_frame((unsigned char *) rtp_buf, rtp_buf_size, rtp_timestamp);
+
+        pthread_mutex_lock(&rtp_mutex);
+        rtp_ready = 0;
+        pthread_mutex_unlock(&rtp_mutex);
+    }
+
+    return NULL;
+}
+
+int send_frame(unsigned char *buf, int size, double timestamp) {
+    static int warned = 0;
+    static rtp_packet_t *packets = NULL;
+    static struct mmsghdr *msgs = NULL;
+    static int max_packets = 0;
+
+    jpeg_info_t info;
+    int type, i, offs, len, header_len, num_packets;
+    uint32_t rtp_ts = (uint64_t) (timestamp * RTP_CLOCK_RATE);
+    unsigned char *h;
+
+    if (jpeg_parse(buf, size, &info) < 0) {
+        DEBUG("rtp: invalid jpeg frame");
+        return -1;
+    }
+
+    /* RFC 2435 only covers baseline YUV 4:2:2 (type 0) and 4:2:0 (type 1) frames,
+     * up to 2040x2040, using the standard huffman tables and 8 bit quantization tables */
+    type = -1;
+    if (info.num_components == 3 && !info.progressive && info.h_samp[0] == 2 &&
+        info.h_samp[1] == 1 && info.v_samp[1] == 1 && info.h_samp[2] == 1 && info.v_samp[2] == 1 &&
+        info.tq[1] == info.tq[2]) {
+
+        if (info.v_samp[0] == 1) {
+            type = 0;
+        }
+        else if (info.v_samp[0] == 2) {
+            type = 1;
+        }
+    }
+
+    if (type < 0 || info.width > 2040 || info.height > 2040 || !info.std_huffman ||
+        !info.qtables[info.tq[0]] || !info.qtables[info.tq[1]] ||
+        info.qtable_precision[info.tq[0]] || info.qtable_precision[info.tq[1]]) {
+
+        if (!warned) {
+            ERROR("rtp: unsupported jpeg format (%dx%d), frames will not be sent", info.width, info.height);
+            warned = 1;
+        }
+
+        return -1;
+    }
+
+    if (info.restart_interval) {
+        type += 64;
+    }
+
+    /* prepare all the packets of the frame; the payload is not copied,
+     * it's referenced directly from the frame buffer */
+    num_packets = 0;
+    for (offs = 0; offs < info.scan_len; offs += len) {
+        if (num_packets >= max_packets) {
+            max_packets = max_packets ? max_packets * 2 : 64;
+            packets = realloc(packets, sizeof(rtp_packet_t) * max_packets);
+            msgs = realloc(msgs, sizeof(struct mmsghdr) * max_packets);
+        }
+
+        h = packets[num_packets].header;
+
+        /* rtp header */
+        h[0] = 0x80; /* version 2 */
+        h[1] = RTP_PAYLOAD_TYPE_JPEG;
+        h[2] = rtp_seq >> 8;
+        h[3] = rtp_seq;
+        h[4] = rtp_ts >> 24;
+        h[5] = rtp_ts >> 16;
+        h[6] = rtp_ts >> 8;
+        h[7] = rtp_ts;
+        h[8] = rtp_ssrc >> 24;
+        h[9] = rtp_ssrc >> 16;
+        h[10] = rtp_ssrc >> 8;
+        h[11] = rtp_ssrc;
+        rtp_seq++;
+        header_len = RTP_HEADER_LEN;
+
+        /* main jpeg header */
+        h[header_len++] = 0; /* type specific */
+        h[header_len++] = offs >> 16;
+        h[header_len++] = offs >> 8;
+        h[header_len++] = offs;
+        h[header_len++] = type;
+        h[header_len++] = 255; /* Q >= 128, quantization tables are sent in-band */
+        h[header_len++] = info.width / 8;
+        h[header_len++] = info.height / 8;
+
+        if (info.restart_interval) {
+            h[header_len++] = info.restart_interval >> 8;
+            h[header_len++] = info.restart_interval;
+            h[header_len++] = 0xFF; /* F = L = 1, count = 0x3FFF */
+            h[header_len++] = 0xFF;
+        }
+
+        if (offs == 0) {
+            h[header_len++] = 0; /* MBZ */
+            h[header_len++] = 0; /* 8 bit precision */
+            h[header_len++] = 0;
+            h[header_len++] = 128;
+            memcpy(h + header_len, info.qtables[info.tq[0]], 64);
+            memcpy(h + header_len + 64, info.qtables[info.tq[1]], 64);
+            header_len += 128;
+        }
+
+        len = MIN(info.scan_len - offs, RTP_MAX_PACKET_LEN - header_len);
+
+        packets[num_packets].iov[0].iov_base = h;
+        packets[num_packets].iov[0].iov_len = header_len;
+        packets[num_packets].iov[1].iov_base = buf + info.scan_offset + offs;
+        packets[num_packets].iov[1].iov_len = len;
+        num_packets++;
+    }
+
+    if (!num_packets) {
+        return -1;
+    }
+
+    /* set the marker bit on the last packet of the frame */
+    packets[num_packets - 1].header[1] |= 0x80;
+
+    for (i = 0; i < num_packets; i++) {
+        memset(&msgs[i], 0, sizeof(struct mmsghdr));
+        msgs[i].msg_hdr.msg_name = &rtp_addr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(rtp_addr);
+        msgs[i].msg_hdr.msg_iov = packets[i].iov;
+        msgs[i].msg_hdr.msg_iovlen = 2;
+    }
+
+    DEBUG("rtp: sending frame in %d packets", num_packets);
+    send_paced(msgs, num_packets);
+
+    return 0;
+}
+
+void send_paced(struct mmsghdr *msgs, int num_packets) {
+    int num_batches = (num_packets + RTP_BATCH_LEN - 1) / RTP_BATCH_LEN;
+    double batch_int = num_batches > 1 ? rtp_frame_int * RTP_PACING_RATIO / (num_batches - 1) : 0;
+    struct timespec ts;
+    int i, sent, len;
+
+    /* spreading the packets over the frame interval avoids
+     * overflowing switch and receiver buffers with large frames */
+    for (i = 0; i < num_packets; i += sent) {
+        len = MIN(RTP_BATCH_LEN, num_packets - i);
+        sent = sendmmsg(rtp_fd, msgs + i, len, 0);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                sent = 0;
+                continue;
+            }
+
+            ERRNO("rtp: sendmmsg() failed");
+            return;
+        }
+        else if (sent == 0) {
+            return;
+        }
+
+        if (i + sent < num_packets && batch_int > 0) {
+            ts.tv_sec = 0;
+            ts.tv_nsec = MIN(batch_int, 0.1) * 1000000000;
+            nanosleep(&ts, NULL);
+        }
+    }
+}
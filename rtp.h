@@ -0,0 +1,36 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __RTP_H
+#define __RTP_H
+
+#define RTP_PAYLOAD_TYPE_JPEG   26
+#define RTP_CLOCK_RATE          90000
+#define RTP_MAX_PACKET_LEN      1400
+#define RTP_BATCH_LEN           32 /* packets per sendmmsg() call */
+#define RTP_PACING_RATIO        0.5 /* send a frame within this fraction of the frame interval */
+#define DEF_RTP_TTL             1
+
+
+int                 rtp_init(char *spec);
+void                rtp_publish(char *buf, int size, double timestamp);
+void                rtp_stop();
+
+
+#endif /* __RTP_H */
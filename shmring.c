@@ -0,0 +1,134 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <arpa/inet.h>
+
+#include "streameye.h"
+#include "common.h"
+#include "shmring.h"
+#include "streameye_shm.h"
+
+
+    /* locals */
+
+static char *ring_name = NULL;
+static se_shm_header_t *ring = NULL;
+static size_t ring_len = 0;
+
+
+int shm_ring_init(char *name) {
+    uint32_t slot_stride = (sizeof(se_shm_slot_t) + JPEG_BUF_LEN + 4095) & ~4095;
+    int fd;
+
+    fd = shm_open(name, O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        ERRNO("shm_open() failed");
+        return -1;
+    }
+
+    /* pages are only allocated as they're written to,
+     * so the actual memory usage follows the frame size */
+    ring_len = sizeof(se_shm_header_t) + (size_t) SHM_RING_SLOTS * slot_stride;
+    if (ftruncate(fd, ring_len) < 0) {
+        ERRNO("ftruncate() failed");
+        close(fd);
+        return -1;
+    }
+
+    ring = mmap(NULL, ring_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring == MAP_FAILED) {
+        ERRNO("mmap() failed");
+        ring = NULL;
+        return -1;
+    }
+
+    /* an existing ring (e.g. after a hand-off) is reused as is */
+    if (ring->magic != SE_SHM_MAGIC || ring->version != SE_SHM_VERSION ||
+        ring->num_slots != SHM_RING_SLOTS || ring->slot_stride != slot_stride) {
+
+        memset(ring, 0, sizeof(se_shm_header_t));
+        ring->num_slots = SHM_RING_SLOTS;
+        ring->slot_size = JPEG_BUF_LEN;
+        ring->slot_stride = slot_stride;
+        ring->version = SE_SHM_VERSION;
+        __atomic_store_n(&ring->magic, SE_SHM_MAGIC, __ATOMIC_RELEASE);
+    }
+
+    ring_name = strdup(name);
+    INFO("publishing frames to shared memory ring %s", name);
+
+    return 0;
+}
+
+void shm_ring_publish(char *buf, int size, double timestamp) {
+    static uint64_t last_seq = 0;
+    se_shm_slot_t *slot;
+    uint64_t ring_seq;
+
+    if (!ring) {
+        return;
+    }
+
+    /* the ring keeps its own sequence, which carries on across restarts */
+    ring_seq = MAX(__atomic_load_n(&ring->latest_seq, __ATOMIC_RELAXED), last_seq) + 1;
+    last_seq = ring_seq;
+    slot = SE_SHM_SLOT(ring, ring_seq % ring->num_slots);
+
+    /* invalidate the slot before overwriting it, so that readers
+     * still holding the old frame can tell it's gone */
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    memcpy(slot->data, buf, size);
+    slot->len = size;
+    slot->timestamp = timestamp * 1000000;
+
+    __atomic_store_n(&slot->seq, ring_seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->latest_seq, ring_seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->futex, (uint32_t) ring_seq, __ATOMIC_RELEASE);
+
+    syscall(SYS_futex, &ring->futex, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+void shm_ring_stop(int unlink) {
+    if (!ring) {
+        return;
+    }
+
+    munmap(ring, ring_len);
+    ring = NULL;
+
+    if (unlink) {
+        shm_unlink(ring_name);
+    }
+
+    free(ring_name);
+}
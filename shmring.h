@@ -0,0 +1,31 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SHMRING_H
+#define __SHMRING_H
+
+#define SHM_RING_SLOTS          8
+
+
+int                 shm_ring_init(char *name);
+void                shm_ring_publish(char *buf, int size, double timestamp);
+void                shm_ring_stop(int unlink);
+
+
+#endif /* __SHMRING_H */
@@ -31,10 +31,14 @@
 
 #define REQ_BUF_LEN             4096
 #define INPUT_BUF_LEN           1024 * 1024 /* 1MB */
+#define SEPARATOR_LOOK_BEHIND   (2 * INPUT_BUF_LEN)
 #define JPEG_BUF_LEN            1024 * 1024 * 10 /* 10MB */
 #define JPEG_START              "\xFF\xD8"
 #define JPEG_END                "\xFF\xD9"
 
+extern client_t **              clients;
+extern pthread_mutex_t          clients_mutex;
+
 void                            cleanup_client(client_t *client);
 
 
@@ -0,0 +1,144 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Producer interface for the streamEye memfd frame input (see the -I option).
+ *
+ * Frames are passed as file descriptors over a UNIX sequenced-packet socket, so that their data is
+ * never copied. Each frame lives either in a memfd of its own, sealed against any change, or somewhere
+ * in a memfd shared by all frames (e.g. a ring of slots). Every memfd must be sealed against shrinking
+ * and writing; a shared memfd is sealed with F_SEAL_FUTURE_WRITE once the producer has mapped it, so
+ * that the producer's own mapping is the only way left to change it:
+ *
+ *     int sock = se_memfd_connect("/run/streameye.sock");
+ *     int fd = memfd_create("frame", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+ *
+ *     write(fd, jpeg, len);
+ *     fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+ *     se_memfd_send(sock, fd, id, 0, len);
+ *     close(fd);
+ *
+ * A shared memfd is passed along with its first frame only; the following frames are sent with
+ * fd = -1 and refer to the last memfd received. streamEye releases each frame, by sending back its
+ * id, once it no longer uses it (see se_memfd_wait_release()); only then may the producer reuse the
+ * region of a shared memfd holding that frame. streamEye maps memfds read-only and never writes to
+ * them, so every frame is read from the producer's memory as it was when sent.
+ *
+ * This file has no dependencies other than libc and can be copied into producer projects.
+ */
+
+#ifndef __STREAMEYE_MEMFD_H
+#define __STREAMEYE_MEMFD_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define SE_MEMFD_MAGIC          0x53454D46 /* "SEMF" */
+
+#ifndef F_SEAL_FUTURE_WRITE
+#define F_SEAL_FUTURE_WRITE     0x0010 /* linux 5.1 */
+#endif
+
+typedef struct {
+    uint32_t                magic;
+    uint32_t                id; /* chosen by the producer, sent back on release */
+    uint64_t                offset;
+    uint64_t                len;
+} se_memfd_frame_t;
+
+typedef struct {
+    uint32_t                magic;
+    uint32_t                id;
+} se_memfd_release_t;
+
+
+static inline int se_memfd_connect(const char *path) {
+    struct sockaddr_un addr;
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+/* sends a frame found at offset in the memfd fd (or in the last memfd sent, when fd is -1) */
+static inline int se_memfd_send(int sock, int fd, uint32_t id, uint64_t offset, uint64_t len) {
+    se_memfd_frame_t frame = {SE_MEMFD_MAGIC, id, offset, len};
+    char cmsg_buf[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = {&frame, sizeof(frame)};
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (fd >= 0) {
+        msg.msg_control = cmsg_buf;
+        msg.msg_controllen = sizeof(cmsg_buf);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == sizeof(frame) ? 0 : -1;
+}
+
+/* waits for a frame to be released;
+ * returns 1 and sets id when a frame was released, 0 on timeout, -1 on error or when disconnected */
+static inline int se_memfd_wait_release(int sock, int timeout_ms, uint32_t *id) {
+    struct pollfd pfd = {sock, POLLIN, 0};
+    se_memfd_release_t release;
+    ssize_t size;
+    int r = poll(&pfd, 1, timeout_ms);
+
+    if (r <= 0) {
+        return r < 0 && errno != EINTR ? -1 : 0;
+    }
+
+    size = recv(sock, &release, sizeof(release), 0);
+    if (size != sizeof(release) || release.magic != SE_MEMFD_MAGIC) {
+        return -1;
+    }
+
+    *id = release.id;
+
+    return 1;
+}
+
+
+#endif /* __STREAMEYE_MEMFD_H */
@@ -0,0 +1,174 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Consumer interface for the streamEye shared memory frame ring (see the -S option).
+ *
+ * Frames are read in place, without copying: a reader maps the ring, picks the newest frame
+ * and, once done with its data, checks that the slot hasn't been overwritten in the meantime:
+ *
+ *     se_shm_t shm;
+ *     se_shm_frame_t frame = {0};
+ *
+ *     se_shm_open(&shm, "/streameye");
+ *     while (se_shm_wait(&shm, frame.seq, 1000) >= 0) {
+ *         if (se_shm_latest(&shm, &frame) > 0) {
+ *             process(frame.data, frame.len);
+ *             if (!se_shm_valid(&frame)) {
+ *                 discard();
+ *             }
+ *         }
+ *     }
+ *
+ * This file has no dependencies other than libc and can be copied into consumer projects.
+ */
+
+#ifndef __STREAMEYE_SHM_H
+#define __STREAMEYE_SHM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define SE_SHM_MAGIC            0x5345534D /* "SESM" */
+#define SE_SHM_VERSION          1
+
+typedef struct {
+    uint32_t                magic;
+    uint32_t                version;
+    uint32_t                num_slots;
+    uint32_t                slot_size; /* maximal frame size */
+    uint32_t                slot_stride;
+    uint32_t                futex; /* low 32 bits of latest_seq, for waiting */
+    uint64_t                latest_seq; /* sequence number of the newest complete frame, 0 if none */
+} se_shm_header_t;
+
+typedef struct {
+    uint64_t                seq; /* 0 while the slot is being written */
+    uint64_t                timestamp; /* microseconds since the epoch */
+    uint32_t                len;
+    uint32_t                reserved[3];
+    unsigned char           data[];
+} se_shm_slot_t;
+
+typedef struct {
+    se_shm_header_t *       header;
+    size_t                  map_len;
+} se_shm_t;
+
+typedef struct {
+    const unsigned char *   data;
+    uint32_t                len;
+    uint64_t                seq;
+    uint64_t                timestamp;
+    const se_shm_slot_t *   slot;
+} se_shm_frame_t;
+
+
+#define SE_SHM_SLOT(header, index) \
+        ((se_shm_slot_t *) ((char *) (header) + sizeof(se_shm_header_t) + (size_t) (index) * (header)->slot_stride))
+
+static inline int se_shm_open(se_shm_t *shm, const char *name) {
+    se_shm_header_t header;
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (read(fd, &header, sizeof(header)) != sizeof(header) ||
+        header.magic != SE_SHM_MAGIC || header.version != SE_SHM_VERSION) {
+
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    shm->map_len = sizeof(se_shm_header_t) + (size_t) header.num_slots * header.slot_stride;
+    shm->header = mmap(NULL, shm->map_len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (shm->header == MAP_FAILED) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static inline void se_shm_close(se_shm_t *shm) {
+    munmap(shm->header, shm->map_len);
+}
+
+/* tells whether the frame data is still intact; call it after reading the data */
+static inline int se_shm_valid(const se_shm_frame_t *frame) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&frame->slot->seq, __ATOMIC_RELAXED) == frame->seq;
+}
+
+/* returns 1 when a frame is available, 0 otherwise */
+static inline int se_shm_latest(se_shm_t *shm, se_shm_frame_t *frame) {
+    uint64_t seq = __atomic_load_n(&shm->header->latest_seq, __ATOMIC_ACQUIRE);
+    if (!seq) {
+        return 0;
+    }
+
+    se_shm_slot_t *slot = SE_SHM_SLOT(shm->header, seq % shm->header->num_slots);
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != seq) {
+        return 0; /* already being overwritten */
+    }
+
+    frame->data = slot->data;
+    frame->len = slot->len;
+    frame->seq = seq;
+    frame->timestamp = slot->timestamp;
+    frame->slot = slot;
+
+    return se_shm_valid(frame) ? 1 : 0;
+}
+
+/* waits until a frame newer than last_seq is published;
+ * returns 0 when a new frame is available, -1 on timeout or error */
+static inline int se_shm_wait(se_shm_t *shm, uint64_t last_seq, int timeout_ms) {
+    struct timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+    uint32_t futex;
+
+    while (__atomic_load_n(&shm->header->latest_seq, __ATOMIC_ACQUIRE) <= last_seq) {
+        futex = __atomic_load_n(&shm->header->futex, __ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&shm->header->latest_seq, __ATOMIC_ACQUIRE) > last_seq) {
+            break;
+        }
+
+        if (syscall(SYS_futex, &shm->header->futex, FUTEX_WAIT, futex, &ts, NULL, 0) < 0 &&
+            errno == ETIMEDOUT) {
+
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+#endif /* __STREAMEYE_SHM_H */
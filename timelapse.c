@@ -0,0 +1,522 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+
+#include "streameye.h"
+#include "common.h"
+#include "ratelimit.h"
+#include "motion.h"
+#include "timerwheel.h"
+#include "timelapse.h"
+#include "realtime.h"
+
+
+/* clients asking for a frame every few seconds (or minutes) don't get a thread of their own;
+ * they sit in a timer wheel, costing nothing until they're due. Due clients are collected
+ * whenever a frame is published, so that all of them share a single copy of that frame, which
+ * is then written out by one delivery thread, over non-blocking sockets. Deliveries are aligned
+ * to multiples of the interval, so that clients asking for the same interval get the same frames. */
+
+
+    /* locals */
+
+static double send_timeout = DEF_CLIENT_TIMEOUT;
+static double start_time = 0;
+static int started = 0;
+static int stopping = 0;
+static int wake_fd = -1;
+static pthread_t thread;
+static pthread_mutex_t timelapse_mutex = PTHREAD_MUTEX_INITIALIZER;
+static timer_wheel_t wheel;
+static client_t **due = NULL; /* clients collected at publish, not yet taken by the delivery thread */
+static int num_due = 0;
+static int max_due = 0;
+static int num_busy = 0; /* clients that are either due or being delivered to */
+
+
+    /* local functions */
+
+static unsigned long    current_tick();
+static int              start();
+static void             wake();
+static void             collect(wheel_timer_t *timer, void *arg);
+static void             schedule(client_t *client);
+static void             release_frame(client_t *client);
+static int              send_pending(client_t *client);
+static void             finish(client_t *client, int result);
+static void *           run(void *arg);
+
+
+void timelapse_init(double timeout) {
+    send_timeout = timeout;
+}
+
+double parse_interval(char *str) {
+    char *err = NULL;
+    double interval = strtod(str, &err);
+
+    switch (*err) {
+        case 's':
+            err++;
+            break;
+
+        case 'm':
+            interval *= 60;
+            err++;
+            break;
+
+        case 'h':
+            interval *= 3600;
+            err++;
+            break;
+    }
+
+    if (*err != 0 || err == str || interval < 0) {
+        return -1;
+    }
+
+    return interval;
+}
+
+int timelapse_eligible(client_t *client) {
+    /* websocket clients need their acknowledgements read, so they keep their threads */
+    return client->interval > 0 && !client->websocket && !client->crop &&
+            !client->motion_threshold && !client->framing && !client->batch_max;
+}
+
+int timelapse_add_client(client_t *client) {
+    if (pthread_mutex_lock(&timelapse_mutex)) {
+        ERROR("pthread_mutex_lock() failed");
+        return -1;
+    }
+
+    if (!started && start() < 0) {
+        pthread_mutex_unlock(&timelapse_mutex);
+        return -1;
+    }
+
+    DEBUG_CLIENT(client, "time-lapse delivery every %.1lf s", client->interval);
+
+    /* the first frame is sent right away */
+    client->timelapse = 1;
+    client->timelapse_timer.data = client;
+    timer_wheel_add(&wheel, &client->timelapse_timer, current_tick());
+
+    if (pthread_mutex_unlock(&timelapse_mutex)) {
+        ERROR("pthread_mutex_unlock() failed");
+    }
+
+    return 0;
+}
+
+
+    /* scheduling */
+
+unsigned long current_tick() {
+    double elapsed = get_now() - start_time;
+
+    return MAX(0, elapsed) / TIMELAPSE_TICK;
+}
+
+int start() {
+    wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wake_fd < 0) {
+        ERRNO("eventfd() failed");
+        return -1;
+    }
+
+    start_time = get_now();
+    timer_wheel_init(&wheel, 0);
+
+    if (pthread_create(&thread, NULL, run, NULL)) {
+        ERROR("pthread_create() failed");
+        close(wake_fd);
+        return -1;
+    }
+
+    started = 1;
+
+    return 0;
+}
+
+void wake() {
+    uint64_t value = 1;
+
+    if (write(wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        ERRNO("time-lapse: write() failed");
+    }
+}
+
+void collect(wheel_timer_t *timer, void *arg) {
+    if (num_due == max_due) {
+        max_due = MAX(16, max_due * 2);
+        due = realloc(due, sizeof(client_t *) * max_due);
+    }
+
+    due[num_due++] = timer->data;
+}
+
+void schedule(client_t *client) {
+    /* must be called with the time-lapse mutex locked */
+    unsigned long interval = MAX(1, client->interval / TIMELAPSE_TICK + 0.5);
+
+    timer_wheel_add(&wheel, &client->timelapse_timer, (current_tick() / interval + 1) * interval);
+}
+
+void timelapse_publish() {
+    /* must be called with the jpeg mutex locked */
+    timelapse_frame_t *frame = NULL;
+    int first, i;
+
+    if (!started) {
+        return;
+    }
+
+    if (pthread_mutex_lock(&timelapse_mutex)) {
+        ERROR("pthread_mutex_lock() failed");
+        return;
+    }
+
+    first = num_due;
+    timer_wheel_advance(&wheel, current_tick(), collect, NULL);
+
+    if (num_due > first) {
+        frame = malloc(sizeof(timelapse_frame_t) + jpeg_size);
+        if (frame) {
+            frame->refs = num_due - first;
+            frame->seq = jpeg_seq;
+            frame->size = jpeg_size;
+            frame->header_len = format_multipart_header(frame->header, MULTIPART_HEADER_LEN, jpeg_size,
+                    motion_score(jpeg_seq));
+            memcpy(frame->data, jpeg_buf, jpeg_size);
+
+            for (i = first; i < num_due; i++) {
+                due[i]->timelapse_frame = frame;
+            }
+
+            num_busy += num_due - first;
+            DEBUG("time-lapse: frame %u due for %d clients", jpeg_seq, num_due - first);
+        }
+        else {
+            ERROR("malloc() failed");
+            for (i = first; i < num_due; i++) {
+                schedule(due[i]);
+            }
+
+            num_due = first;
+        }
+    }
+
+    if (pthread_mutex_unlock(&timelapse_mutex)) {
+        ERROR("pthread_mutex_unlock() failed");
+    }
+
+    if (frame) {
+        wake();
+    }
+}
+
+
+    /* delivery */
+
+void release_frame(client_t *client) {
+    timelapse_frame_t *frame = client->timelapse_frame;
+
+    /* frames are only released by the delivery thread */
+    client->timelapse_frame = NULL;
+    if (--frame->refs == 0) {
+        free(frame);
+    }
+}
+
+int send_pending(client_t *client) {
+    timelapse_frame_t *frame = client->timelapse_frame;
+    int total = frame->header_len + frame->size;
+    int data_offs, n;
+    struct iovec iov[2];
+    struct msghdr msg;
+    ssize_t written;
+
+    while (client->timelapse_offs < total) {
+        n = 0;
+        data_offs = MAX(0, client->timelapse_offs - frame->header_len);
+        if (client->timelapse_offs < frame->header_len) {
+            iov[n].iov_base = frame->header + client->timelapse_offs;
+            iov[n++].iov_len = frame->header_len - client->timelapse_offs;
+        }
+        iov[n].iov_base = frame->data + data_offs;
+        iov[n++].iov_len = frame->size - data_offs;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n;
+
+        written = sendmsg(client->stream_fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            else if (errno == EPIPE || errno == ECONNRESET) {
+                INFO_CLIENT(client, "connection closed");
+                return -1;
+            }
+
+            ERRNO_CLIENT(client, "sendmsg() failed");
+            return -1;
+        }
+
+        client->timelapse_offs += written;
+    }
+
+    return 1;
+}
+
+void finish(client_t *client, int result) {
+    double now = get_now();
+
+    release_frame(client);
+
+    if (result > 0) {
+        client->frame_int = client->frame_int * 0.7 + (now - client->last_frame_time) * 0.3;
+        client->last_frame_time = now;
+        client->frames_sent++;
+    }
+    else if (result == 0) {
+        client->frames_skipped++;
+    }
+
+    if (pthread_mutex_lock(&timelapse_mutex)) {
+        ERROR("pthread_mutex_lock() failed");
+    }
+
+    num_busy--;
+    if (result >= 0) {
+        schedule(client);
+    }
+
+    if (pthread_mutex_unlock(&timelapse_mutex)) {
+        ERROR("pthread_mutex_unlock() failed");
+    }
+
+    if (result < 0) {
+        cleanup_client(client);
+    }
+}
+
+void *run(void *arg) {
+    client_t **active = NULL;
+    struct pollfd *fds = NULL;
+    int num_active = 0, max_active = 0, first, i, j, r;
+    uint64_t value;
+    double now;
+
+    realtime_thread(REALTIME_CLIENTS);
+
+    while (1) {
+        now = get_now();
+
+        /* carry on with the deliveries whose sockets became writable */
+        for (i = 0; i < num_active; i++) {
+            if (fds[i + 1].revents) {
+                r = send_pending(active[i]);
+            }
+            else if (now - active[i]->timelapse_start > send_timeout) {
+                ERROR_CLIENT(active[i], "timeout writing to client");
+                r = -1;
+            }
+            else {
+                continue;
+            }
+
+            if (r != 0) {
+                finish(active[i], r > 0 ? 1 : -1);
+                active[i] = NULL;
+            }
+        }
+
+        if (pthread_mutex_lock(&timelapse_mutex)) {
+            ERROR("pthread_mutex_lock() failed");
+        }
+
+        if (stopping) {
+            pthread_mutex_unlock(&timelapse_mutex);
+            break;
+        }
+
+        if (!fds || num_active + num_due > max_active) {
+            max_active = MAX(16, 2 * (num_active + num_due));
+            active = realloc(active, sizeof(client_t *) * max_active);
+            fds = realloc(fds, sizeof(struct pollfd) * (max_active + 1));
+        }
+
+        first = num_active;
+        memcpy(active + num_active, due, sizeof(client_t *) * num_due);
+        num_active += num_due;
+        num_due = 0;
+
+        if (pthread_mutex_unlock(&timelapse_mutex)) {
+            ERROR("pthread_mutex_unlock() failed");
+        }
+
+        /* new deliveries are attempted right away; most of the time,
+         * the frame fits in the socket buffer and no polling is needed */
+        for (i = first; i < num_active; i++) {
+            active[i]->timelapse_offs = 0;
+            active[i]->timelapse_start = now;
+
+            if (!rate_limiter_consume(&active[i]->rate_limiter, active[i]->timelapse_frame->size)) {
+                DEBUG_CLIENT(active[i], "rate limit reached, skipping frame %u", active[i]->timelapse_frame->seq);
+                finish(active[i], 0);
+                active[i] = NULL;
+                continue;
+            }
+
+            DEBUG_CLIENT(active[i], "writing time-lapse frame %u", active[i]->timelapse_frame->seq);
+            r = send_pending(active[i]);
+            if (r != 0) {
+                finish(active[i], r);
+                active[i] = NULL;
+            }
+        }
+
+        for (i = 0, j = 0; i < num_active; i++) {
+            if (active[i]) {
+                active[j++] = active[i];
+            }
+        }
+        num_active = j;
+
+        fds[0].fd = wake_fd;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        for (i = 0; i < num_active; i++) {
+            fds[i + 1].fd = active[i]->stream_fd;
+            fds[i + 1].events = POLLOUT;
+            fds[i + 1].revents = 0;
+        }
+
+        /* with no delivery in progress, sleep until the next batch is due */
+        if (poll(fds, num_active + 1, num_active ? 1000 : -1) < 0 && errno != EINTR) {
+            ERRNO("time-lapse: poll() failed");
+        }
+
+        if (fds[0].revents && read(wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+            ERRNO("time-lapse: read() failed");
+        }
+    }
+
+    /* the clients themselves are cleaned up by timelapse_stop() */
+    for (i = 0; i < num_active; i++) {
+        release_frame(active[i]);
+    }
+    for (i = 0; i < num_due; i++) {
+        release_frame(due[i]);
+    }
+
+    free(active);
+    free(fds);
+
+    return NULL;
+}
+
+
+    /* hand-off & shutdown */
+
+void timelapse_park(double timeout) {
+    double start = get_now();
+    int busy, i;
+
+    if (!started) {
+        return;
+    }
+
+    /* wait for the deliveries in progress, so that clients are parked at a frame boundary */
+    while (1) {
+        pthread_mutex_lock(&timelapse_mutex);
+        busy = num_busy;
+        pthread_mutex_unlock(&timelapse_mutex);
+
+        if (!busy || get_now() - start > timeout) {
+            break;
+        }
+
+        usleep(10000);
+    }
+
+    pthread_mutex_lock(&timelapse_mutex);
+    pthread_mutex_lock(&clients_mutex);
+    for (i = 0; i < num_clients; i++) {
+        if (clients[i]->timelapse && timer_wheel_pending(&clients[i]->timelapse_timer)) {
+            timer_wheel_del(&wheel, &clients[i]->timelapse_timer);
+            clients[i]->parked = 1;
+        }
+    }
+    pthread_mutex_unlock(&clients_mutex);
+    pthread_mutex_unlock(&timelapse_mutex);
+}
+
+void timelapse_stop() {
+    client_t **owned = NULL;
+    int num_owned = 0, i;
+
+    if (!started) {
+        return;
+    }
+
+    pthread_mutex_lock(&timelapse_mutex);
+    stopping = 1;
+    pthread_mutex_unlock(&timelapse_mutex);
+
+    wake();
+    pthread_join(thread, NULL);
+    close(wake_fd);
+    started = 0;
+
+    pthread_mutex_lock(&clients_mutex);
+    for (i = 0; i < num_clients; i++) {
+        if (clients[i]->timelapse) {
+            owned = realloc(owned, sizeof(client_t *) * (num_owned + 1));
+            owned[num_owned++] = clients[i];
+        }
+    }
+    pthread_mutex_unlock(&clients_mutex);
+
+    for (i = 0; i < num_owned; i++) {
+        cleanup_client(owned[i]);
+    }
+
+    free(owned);
+    free(due);
+    due = NULL;
+    num_due = max_due = 0;
+}
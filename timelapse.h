@@ -0,0 +1,46 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TIMELAPSE_H
+#define __TIMELAPSE_H
+
+#include "client.h"
+
+#define TIMELAPSE_TICK          0.1 /* seconds */
+
+typedef struct timelapse_frame {
+    int             refs;
+    unsigned int    seq;
+    int             header_len;
+    int             size;
+    char            header[MULTIPART_HEADER_LEN];
+    char            data[];
+} timelapse_frame_t;
+
+
+void                timelapse_init(double timeout);
+double              parse_interval(char *str);
+int                 timelapse_eligible(client_t *client);
+int                 timelapse_add_client(client_t *client);
+void                timelapse_publish();
+void                timelapse_park(double timeout);
+void                timelapse_stop();
+
+
+#endif /* __TIMELAPSE_H */
@@ -0,0 +1,155 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timerwheel.h"
+
+
+/* a hierarchical timer wheel: level 0 has one slot per tick, each of the following
+ * levels has one slot per WHEEL_SLOTS ticks of the previous one; timers are kept in the
+ * level matching how far away they are, and are moved (cascaded) one level down whenever
+ * the lower level wraps around, so that adding, removing and expiring a timer are all O(1) */
+
+
+    /* local functions */
+
+static void         list_init(wheel_timer_t *head);
+static void         list_add(wheel_timer_t *head, wheel_timer_t *timer);
+static void         list_del(wheel_timer_t *timer);
+static void         place(timer_wheel_t *wheel, wheel_timer_t *timer);
+static void         cascade(timer_wheel_t *wheel, int level);
+
+
+void list_init(wheel_timer_t *head) {
+    head->next = head->prev = head;
+}
+
+void list_add(wheel_timer_t *head, wheel_timer_t *timer) {
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+void list_del(wheel_timer_t *timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = timer->prev = NULL;
+}
+
+void place(timer_wheel_t *wheel, wheel_timer_t *timer) {
+    unsigned long delta = timer->expires - wheel->now;
+    int level = 0;
+
+    while (level < WHEEL_LEVELS - 1 && delta >= 1UL << (WHEEL_BITS * (level + 1))) {
+        level++;
+    }
+
+    list_add(&wheel->slots[level][(timer->expires >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)], timer);
+}
+
+void cascade(timer_wheel_t *wheel, int level) {
+    wheel_timer_t *head = &wheel->slots[level][(wheel->now >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)];
+    wheel_timer_t *timer;
+
+    while (head->next != head) {
+        timer = head->next;
+        list_del(timer);
+        place(wheel, timer);
+    }
+}
+
+
+void timer_wheel_init(timer_wheel_t *wheel, unsigned long now) {
+    int i, j;
+
+    for (i = 0; i < WHEEL_LEVELS; i++) {
+        for (j = 0; j < WHEEL_SLOTS; j++) {
+            list_init(&wheel->slots[i][j]);
+        }
+    }
+
+    wheel->now = now;
+    wheel->count = 0;
+}
+
+void timer_wheel_add(timer_wheel_t *wheel, wheel_timer_t *timer, unsigned long expires) {
+    /* timers in the past are due at the next tick,
+     * those too far in the future are clamped to the wheel's range */
+    if ((long) (expires - wheel->now) < 0) {
+        expires = wheel->now;
+    }
+    else if (expires - wheel->now > WHEEL_MAX_DELTA) {
+        expires = wheel->now + WHEEL_MAX_DELTA;
+    }
+
+    timer->expires = expires;
+    place(wheel, timer);
+    wheel->count++;
+}
+
+void timer_wheel_del(timer_wheel_t *wheel, wheel_timer_t *timer) {
+    if (timer_wheel_pending(timer)) {
+        list_del(timer);
+        wheel->count--;
+    }
+}
+
+int timer_wheel_pending(wheel_timer_t *timer) {
+    return timer->next != NULL;
+}
+
+int timer_wheel_advance(timer_wheel_t *wheel, unsigned long now,
+        void (*func)(wheel_timer_t *timer, void *arg), void *arg) {
+
+    wheel_timer_t *head, *timer;
+    int level, expired = 0;
+
+    if (!wheel->count && (long) (now - wheel->now) >= 0) {
+        wheel->now = now + 1; /* nothing to expire, no need to walk the ticks */
+        return 0;
+    }
+
+    /* processes all the ticks up to (and including) now */
+    while ((long) (now - wheel->now) >= 0) {
+        for (level = 1; level < WHEEL_LEVELS; level++) {
+            if ((wheel->now >> (WHEEL_BITS * (level - 1))) & (WHEEL_SLOTS - 1)) {
+                break;
+            }
+
+            cascade(wheel, level);
+        }
+
+        head = &wheel->slots[0][wheel->now & (WHEEL_SLOTS - 1)];
+        while (head->next != head) {
+            timer = head->next;
+            list_del(timer);
+            wheel->count--;
+            expired++;
+            func(timer, arg);
+        }
+
+        wheel->now++;
+    }
+
+    return expired;
+}
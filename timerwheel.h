@@ -0,0 +1,50 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TIMERWHEEL_H
+#define __TIMERWHEEL_H
+
+#define WHEEL_BITS              6
+#define WHEEL_SLOTS             (1 << WHEEL_BITS)
+#define WHEEL_LEVELS            4 /* timers up to 2^24 ticks away */
+#define WHEEL_MAX_DELTA         ((1UL << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+
+typedef struct wheel_timer {
+    struct wheel_timer *    next;
+    struct wheel_timer *    prev;
+    unsigned long           expires; /* in ticks */
+    void *                  data;
+} wheel_timer_t;
+
+typedef struct {
+    unsigned long   now; /* the next tick to be processed */
+    int             count;
+    wheel_timer_t   slots[WHEEL_LEVELS][WHEEL_SLOTS]; /* list heads */
+} timer_wheel_t;
+
+
+void                timer_wheel_init(timer_wheel_t *wheel, unsigned long now);
+void                timer_wheel_add(timer_wheel_t *wheel, wheel_timer_t *timer, unsigned long expires);
+void                timer_wheel_del(timer_wheel_t *wheel, wheel_timer_t *timer);
+int                 timer_wheel_pending(wheel_timer_t *timer);
+int                 timer_wheel_advance(timer_wheel_t *wheel, unsigned long now,
+                            void (*func)(wheel_timer_t *timer, void *arg), void *arg);
+
+
+#endif /* __TIMERWHEEL_H */
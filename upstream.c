@@ -0,0 +1,472 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include "streameye.h"
+#include "common.h"
+#include "auth.h"
+#include "upstream.h"
+
+
+/* frames relayed from another MJPEG-over-HTTP server (e.g. another streamEye instance);
+ * each part is read using its Content-Length, falling back to looking for the boundary */
+
+const char *UPSTREAM_REQUEST_TEMPLATE =
+        "GET %s HTTP/1.1\r\n"
+        "Host: %s:%s\r\n"
+        "User-Agent: streamEye/%s\r\n"
+        "Connection: close\r\n"
+        "%s"
+        "\r\n";
+
+
+    /* locals */
+
+static char host[256];
+static char port[8];
+static char path[1024];
+static char authorization[BASE64_LENGTH(512) + 32] = "";
+
+static int upstream_fd = -1;
+static char delimiter[128];
+static int delimiter_len = 0;
+static char rbuf[UPSTREAM_BUF_LEN];
+static int rbuf_pos = 0;
+static int rbuf_len = 0;
+static int backoff = UPSTREAM_MIN_BACKOFF;
+
+
+    /* local functions */
+
+static int          connect_upstream();
+static void         disconnect_upstream();
+static int          fill_buf();
+static int          read_line(char *line, int len);
+static int          read_exact(char *buf, int len);
+static int          read_until_delimiter(char *buf, int max_len);
+static int          read_part(char *buf, int max_len);
+
+
+int upstream_init(char *url) {
+    char userinfo[512] = "";
+    char encoded[BASE64_LENGTH(512) + 1];
+    char *p, *q;
+
+    if (strncmp(url, "http://", 7)) {
+        ERROR("upstream: unsupported url \"%s\"", url);
+        return -1;
+    }
+
+    p = url + 7;
+    q = p + strcspn(p, "/");
+    snprintf(path, sizeof(path), "%s", *q ? q : "/");
+
+    /* user:pass@ */
+    char *at = memchr(p, '@', q - p);
+    if (at) {
+        snprintf(userinfo, sizeof(userinfo), "%.*s", (int) (at - p), p);
+        p = at + 1;
+    }
+
+    /* host[:port], with the host possibly being a bracketed ipv6 address */
+    char *colon = NULL;
+    if (*p == '[') {
+        char *bracket = memchr(p, ']', q - p);
+        if (!bracket) {
+            ERROR("upstream: invalid url \"%s\"", url);
+            return -1;
+        }
+        snprintf(host, sizeof(host), "%.*s", (int) (bracket - p - 1), p + 1);
+        if (bracket + 1 < q && bracket[1] == ':') {
+            colon = bracket + 1;
+        }
+    }
+    else {
+        colon = memchr(p, ':', q - p);
+        snprintf(host, sizeof(host), "%.*s", (int) ((colon ? colon : q) - p), p);
+    }
+
+    if (colon) {
+        snprintf(port, sizeof(port), "%.*s", (int) (q - colon - 1), colon + 1);
+    }
+    else {
+        strcpy(port, "80");
+    }
+
+    if (!host[0] || !port[0] || atoi(port) <= 0 || atoi(port) > 65535) {
+        ERROR("upstream: invalid url \"%s\"", url);
+        return -1;
+    }
+
+    if (userinfo[0]) {
+        base64_encode(userinfo, encoded, strlen(userinfo));
+        snprintf(authorization, sizeof(authorization), "Authorization: Basic %s\r\n", encoded);
+    }
+
+    INFO("upstream: relaying frames from http://%s:%s%s", host, port, path);
+
+    return 0;
+}
+
+int upstream_read_frame(char *buf, int max_len) {
+    int size;
+    double start;
+
+    while (running) {
+        if (upstream_fd < 0) {
+            if (connect_upstream() < 0) {
+                INFO("upstream: reconnecting in %d seconds", backoff);
+
+                /* sleep in small steps, so that we quit promptly */
+                start = get_now();
+                while (running && get_now() - start < backoff) {
+                    usleep(100000);
+                }
+
+                backoff = MIN(backoff * 2, UPSTREAM_MAX_BACKOFF);
+                continue;
+            }
+        }
+
+        size = read_part(buf, max_len);
+        if (size > 0) {
+            backoff = UPSTREAM_MIN_BACKOFF;
+            return size;
+        }
+        else if (size == 0) {
+            continue; /* empty part */
+        }
+
+        if (running) {
+            ERROR("upstream: connection lost");
+        }
+        disconnect_upstream();
+    }
+
+    return 0;
+}
+
+void upstream_stop() {
+    disconnect_upstream();
+}
+
+
+    /* connection */
+
+int connect_upstream() {
+    struct addrinfo hints, *addrs, *addr;
+    struct timeval tv;
+    char line[1024];
+    char *request, *p;
+    int r, status;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    r = getaddrinfo(host, port, &hints, &addrs);
+    if (r) {
+        ERROR("upstream: cannot resolve %s: %s", host, gai_strerror(r));
+        return -1;
+    }
+
+    for (addr = addrs; addr; addr = addr->ai_next) {
+        upstream_fd = socket(addr->ai_family, addr->ai_socktype | SOCK_CLOEXEC, addr->ai_protocol);
+        if (upstream_fd < 0) {
+            continue;
+        }
+
+        /* a stalled upstream is treated as a lost connection */
+        tv.tv_sec = UPSTREAM_TIMEOUT;
+        tv.tv_usec = 0;
+        setsockopt(upstream_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(upstream_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+        if (!connect(upstream_fd, addr->ai_addr, addr->ai_addrlen)) {
+            break;
+        }
+
+        close(upstream_fd);
+        upstream_fd = -1;
+    }
+
+    freeaddrinfo(addrs);
+
+    if (upstream_fd < 0) {
+        ERRNO("upstream: connect() failed");
+        return -1;
+    }
+
+    DEBUG("upstream: connected to %s:%s", host, port);
+
+    request = malloc(strlen(UPSTREAM_REQUEST_TEMPLATE) + strlen(path) + strlen(host) + strlen(port) + 16 +
+            strlen(authorization));
+    sprintf(request, UPSTREAM_REQUEST_TEMPLATE, path, host, port, STREAM_EYE_VERSION, authorization);
+    r = write(upstream_fd, request, strlen(request));
+    free(request);
+    if (r < 0) {
+        ERRNO("upstream: write() failed");
+        disconnect_upstream();
+        return -1;
+    }
+
+    /* status line */
+    if (read_line(line, sizeof(line)) < 0) {
+        ERROR("upstream: no response");
+        disconnect_upstream();
+        return -1;
+    }
+    if (sscanf(line, "HTTP/%*s %d", &status) < 1) {
+        ERROR("upstream: invalid response \"%s\"", line);
+        disconnect_upstream();
+        return -1;
+    }
+    if (status != 200) {
+        ERROR("upstream: unexpected response \"%s\"", line);
+        disconnect_upstream();
+        return -1;
+    }
+
+    /* headers, we're only interested in the multipart boundary */
+    delimiter_len = 0;
+    while (1) {
+        if (read_line(line, sizeof(line)) < 0) {
+            ERROR("upstream: incomplete response");
+            disconnect_upstream();
+            return -1;
+        }
+        if (!line[0]) {
+            break;
+        }
+
+        if (!strncasecmp(line, "Content-Type:", 13) && (p = strstr(line, "boundary="))) {
+            p += 9;
+            if (*p == '"') {
+                p++;
+                p[strcspn(p, "\"")] = 0;
+            }
+            else {
+                p[strcspn(p, " ;")] = 0;
+            }
+
+            /* some servers (streamEye included) put the leading dashes in the boundary parameter */
+            snprintf(delimiter, sizeof(delimiter), "%s%s", strncmp(p, "--", 2) ? "--" : "", p);
+            delimiter_len = strlen(delimiter);
+        }
+    }
+
+    if (!delimiter_len) {
+        ERROR("upstream: not a multipart stream");
+        disconnect_upstream();
+        return -1;
+    }
+
+    INFO("upstream: connected to http://%s:%s%s", host, port, path);
+
+    return 0;
+}
+
+void disconnect_upstream() {
+    if (upstream_fd >= 0) {
+        close(upstream_fd);
+        upstream_fd = -1;
+    }
+
+    rbuf_pos = rbuf_len = 0;
+}
+
+
+    /* reading */
+
+int fill_buf() {
+    int size;
+
+    if (rbuf_pos) {
+        memmove(rbuf, rbuf + rbuf_pos, rbuf_len - rbuf_pos);
+        rbuf_len -= rbuf_pos;
+        rbuf_pos = 0;
+    }
+
+    if (rbuf_len == UPSTREAM_BUF_LEN) {
+        ERROR("upstream: line too long");
+        return -1;
+    }
+
+    while (1) {
+        size = read(upstream_fd, rbuf + rbuf_len, UPSTREAM_BUF_LEN - rbuf_len);
+        if (size < 0) {
+            if (errno == EINTR && running) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                ERROR("upstream: timeout");
+            }
+            else if (running) {
+                ERRNO("upstream: read() failed");
+            }
+            return -1;
+        }
+        else if (size == 0) {
+            return -1;
+        }
+
+        rbuf_len += size;
+        return size;
+    }
+}
+
+int read_line(char *line, int len) {
+    char *start, *nl;
+    int line_len;
+
+    while (!(nl = memchr(rbuf + rbuf_pos, '\n', rbuf_len - rbuf_pos))) {
+        if (fill_buf() < 0) {
+            return -1;
+        }
+    }
+
+    start = rbuf + rbuf_pos;
+    line_len = nl - start;
+    rbuf_pos += line_len + 1;
+    if (line_len && nl[-1] == '\r') {
+        line_len--;
+    }
+
+    line_len = MIN(line_len, len - 1);
+    memcpy(line, start, line_len);
+    line[line_len] = 0;
+
+    return line_len;
+}
+
+int read_exact(char *buf, int len) {
+    int offs, size;
+
+    /* whatever we have buffered first, then straight into the destination */
+    offs = MIN(len, rbuf_len - rbuf_pos);
+    memcpy(buf, rbuf + rbuf_pos, offs);
+    rbuf_pos += offs;
+
+    while (offs < len) {
+        size = read(upstream_fd, buf + offs, len - offs);
+        if (size < 0) {
+            if (errno == EINTR && running) {
+                continue;
+            }
+            if (running) {
+                ERRNO("upstream: read() failed");
+            }
+            return -1;
+        }
+        else if (size == 0) {
+            return -1;
+        }
+
+        offs += size;
+    }
+
+    return len;
+}
+
+int read_until_delimiter(char *buf, int max_len) {
+    char *d;
+    int size = 0, avail;
+
+    /* the part data ends with CRLF followed by the next delimiter, which is left in the buffer */
+    while (1) {
+        d = memmem(rbuf + rbuf_pos, rbuf_len - rbuf_pos, delimiter, delimiter_len);
+        avail = d ? d - (rbuf + rbuf_pos) : MAX(0, rbuf_len - rbuf_pos - delimiter_len);
+        if (size + avail > max_len) {
+            ERROR("upstream: frame too large");
+            return -1;
+        }
+
+        memcpy(buf + size, rbuf + rbuf_pos, avail);
+        size += avail;
+        rbuf_pos += avail;
+
+        if (d) {
+            break;
+        }
+        if (fill_buf() < 0) {
+            return -1;
+        }
+    }
+
+    while (size && (buf[size - 1] == '\n' || buf[size - 1] == '\r')) {
+        size--;
+    }
+
+    return size;
+}
+
+int read_part(char *buf, int max_len) {
+    char line[1024];
+    int content_length = -1;
+
+    /* skip anything up to the delimiter */
+    do {
+        if (read_line(line, sizeof(line)) < 0) {
+            return -1;
+        }
+    } while (strncmp(line, delimiter, delimiter_len));
+
+    if (!strncmp(line + delimiter_len, "--", 2)) {
+        DEBUG("upstream: end of multipart stream");
+        return -1;
+    }
+
+    while (1) {
+        if (read_line(line, sizeof(line)) < 0) {
+            return -1;
+        }
+        if (!line[0]) {
+            break;
+        }
+
+        if (!strncasecmp(line, "Content-Length:", 15)) {
+            content_length = atoi(line + 15);
+        }
+    }
+
+    if (content_length < 0) {
+        return read_until_delimiter(buf, max_len);
+    }
+
+    if (content_length > max_len) {
+        ERROR("upstream: frame too large (%d bytes)", content_length);
+        return -1;
+    }
+
+    if (read_exact(buf, content_length) < 0) {
+        return -1;
+    }
+
+    DEBUG("upstream: received frame with %d bytes", content_length);
+
+    return content_length;
+}
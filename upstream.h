@@ -0,0 +1,34 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __UPSTREAM_H
+#define __UPSTREAM_H
+
+#define UPSTREAM_BUF_LEN        64 * 1024
+#define UPSTREAM_TIMEOUT        10 /* seconds */
+#define UPSTREAM_MIN_BACKOFF    1 /* seconds */
+#define UPSTREAM_MAX_BACKOFF    30 /* seconds */
+
+
+int                 upstream_init(char *url);
+int                 upstream_read_frame(char *buf, int max_len);
+void                upstream_stop();
+
+
+#endif /* __UPSTREAM_H */
@@ -0,0 +1,771 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+
+#include "streameye.h"
+#include "common.h"
+#include "uring.h"
+#include "load.h"
+#include "motion.h"
+#include "ratelimit.h"
+
+
+#ifdef HAVE_IO_URING
+
+#include <linux/io_uring.h>
+
+/* the io_uring engine runs in the main thread: it reads the input and accepts connections
+ * through the ring and, for each frame, posts the sends for all idle clients at once;
+ * clients are handed over to the engine by their threads, once the response header is written,
+ * unless they need per-frame decisions (websocket, rate limiting, live mode) */
+
+#define TAG_READ                1
+#define TAG_ACCEPT              2
+#define TAG_HEADER              3
+#define TAG_DATA                4
+#define TAG_INTERNAL            5 /* timeouts and cancellations */
+#define TAG_TIMEOUT             6 /* the timeouts linked to the sends */
+#define TAG_MASK                7
+
+typedef struct {
+    int                     fd;
+    unsigned int *          sq_head;
+    unsigned int *          sq_tail;
+    unsigned int *          sq_mask;
+    unsigned int *          sq_array;
+    unsigned int            sq_entries;
+    unsigned int            sq_local_tail;
+    struct io_uring_sqe *   sqes;
+    unsigned int *          cq_head;
+    unsigned int *          cq_tail;
+    unsigned int *          cq_mask;
+    struct io_uring_cqe *   cqes;
+} ring_t;
+
+
+    /* locals */
+
+static ring_t ring;
+static int ring_open = 0;
+static int enabled = 0;
+static int send_zc = 0;
+static int fixed_buffers = 0;
+static void (*accept_func)(int fd, struct sockaddr_in *addr) = NULL;
+
+static char *slots[URING_SLOTS];
+static int slot_refs[URING_SLOTS];
+static int slot_len = 0;
+static int last_slot = 0;
+
+static struct __kernel_timespec send_timeout;
+
+static int read_posted = 0;
+static int read_done = 0;
+static int read_result = 0;
+
+static int accept_posted = 0;
+static int accepted = 0;
+static struct sockaddr_in accept_addr;
+static socklen_t accept_addr_len;
+
+
+    /* local functions */
+
+static int                      setup_ring();
+static int                      probe_ops();
+static int                      alloc_slots(int len);
+static struct io_uring_sqe *    get_sqe();
+static int                      sq_space();
+static int                      submit(int min_complete);
+static void                     reap();
+static void                     handle_cqe(uint64_t user_data, int res, unsigned int flags);
+static void                     client_failed(client_t *client, int res);
+static void                     client_done(client_t *client);
+static void                     abort_client(client_t *client);
+static void                     link_timeout(struct io_uring_sqe *sqe, client_t *client);
+static void                     queue_client(client_t *client, int slot, int size);
+
+
+int uring_init(int timeout, void (*func)(int fd, struct sockaddr_in *addr)) {
+    if (setup_ring() < 0) {
+        return -1;
+    }
+
+    if (probe_ops() < 0) {
+        close(ring.fd);
+        return -1;
+    }
+
+    if (alloc_slots(URING_MIN_SLOT_LEN) < 0) {
+        close(ring.fd);
+        return -1;
+    }
+
+    send_timeout.tv_sec = timeout;
+    accept_func = func;
+    ring_open = 1;
+    enabled = 1;
+
+    INFO("io_uring: enabled, using %s sends%s", send_zc ? "zero-copy" : "regular",
+            fixed_buffers ? " from registered buffers" : "");
+
+    return 0;
+}
+
+int uring_enabled() {
+    return enabled;
+}
+
+
+    /* ring */
+
+int setup_ring() {
+    struct io_uring_params params;
+    char *sq_ptr;
+    int sq_len, cq_len;
+
+    memset(&params, 0, sizeof(params));
+    ring.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (ring.fd < 0) {
+        ERRNO("io_uring_setup() failed");
+        return -1;
+    }
+
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP)) {
+        ERROR("io_uring: kernel too old");
+        close(ring.fd);
+        return -1;
+    }
+
+    /* the submission and completion rings share a single mapping */
+    sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    sq_ptr = mmap(NULL, MAX(sq_len, cq_len), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            ring.fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) {
+        ERRNO("mmap() failed");
+        close(ring.fd);
+        return -1;
+    }
+
+    ring.sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED) {
+        ERRNO("mmap() failed");
+        close(ring.fd);
+        return -1;
+    }
+
+    ring.sq_head = (unsigned int *) (sq_ptr + params.sq_off.head);
+    ring.sq_tail = (unsigned int *) (sq_ptr + params.sq_off.tail);
+    ring.sq_mask = (unsigned int *) (sq_ptr + params.sq_off.ring_mask);
+    ring.sq_array = (unsigned int *) (sq_ptr + params.sq_off.array);
+    ring.sq_entries = params.sq_entries;
+    ring.sq_local_tail = *ring.sq_tail;
+    ring.cq_head = (unsigned int *) (sq_ptr + params.cq_off.head);
+    ring.cq_tail = (unsigned int *) (sq_ptr + params.cq_off.tail);
+    ring.cq_mask = (unsigned int *) (sq_ptr + params.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *) (sq_ptr + params.cq_off.cqes);
+
+    return 0;
+}
+
+int probe_ops() {
+    static const int required[] = {IORING_OP_READ, IORING_OP_SEND, IORING_OP_ACCEPT,
+            IORING_OP_ASYNC_CANCEL, IORING_OP_TIMEOUT, IORING_OP_LINK_TIMEOUT};
+    struct io_uring_probe *probe;
+    int i, op, r;
+
+    probe = calloc(1, sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op));
+    r = syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PROBE, probe, 256);
+    if (r < 0) {
+        ERRNO("io_uring_register() failed");
+        free(probe);
+        return -1;
+    }
+
+    for (i = 0; i < sizeof(required) / sizeof(int); i++) {
+        op = required[i];
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+            ERROR("io_uring: operation %d not supported", op);
+            free(probe);
+            return -1;
+        }
+    }
+
+    send_zc = IORING_OP_SEND_ZC <= probe->last_op && (probe->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+
+    return 0;
+}
+
+int alloc_slots(int len) {
+    struct iovec iovs[URING_SLOTS];
+    int i, new_len = URING_MIN_SLOT_LEN;
+
+    /* must be called with no sends in flight */
+    while (new_len < len) {
+        new_len *= 2;
+    }
+
+    if (fixed_buffers) {
+        syscall(__NR_io_uring_register, ring.fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+        fixed_buffers = 0;
+    }
+
+    for (i = 0; i < URING_SLOTS; i++) {
+        if (slots[i]) {
+            munmap(slots[i], slot_len);
+        }
+
+        slots[i] = mmap(NULL, new_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (slots[i] == MAP_FAILED) {
+            ERRNO("mmap() failed");
+            slots[i] = NULL;
+            slot_len = 0;
+            return -1;
+        }
+
+        iovs[i].iov_base = slots[i];
+        iovs[i].iov_len = new_len;
+    }
+
+    slot_len = new_len;
+    DEBUG("io_uring: frame buffers of %d bytes", slot_len);
+
+    /* registered buffers are only used by zero-copy sends; when the (locked memory) limits
+     * don't allow registering them, the kernel simply maps the pages for each send */
+    if (send_zc) {
+        if (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS, iovs, URING_SLOTS) < 0) {
+            ERRNO("io_uring: failed to register buffers");
+        }
+        else {
+            fixed_buffers = 1;
+        }
+    }
+
+    return 0;
+}
+
+int sq_space() {
+    return ring.sq_entries - (ring.sq_local_tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE));
+}
+
+struct io_uring_sqe *get_sqe() {
+    struct io_uring_sqe *sqe;
+    unsigned int index;
+
+    if (!sq_space() && (submit(0) < 0 || !sq_space())) {
+        ERROR("io_uring: submission queue full");
+        return NULL;
+    }
+
+    index = ring.sq_local_tail & *ring.sq_mask;
+    sqe = &ring.sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring.sq_array[index] = index;
+    ring.sq_local_tail++;
+
+    return sqe;
+}
+
+int submit(int min_complete) {
+    unsigned int to_submit;
+    int r;
+
+    __atomic_store_n(ring.sq_tail, ring.sq_local_tail, __ATOMIC_RELEASE);
+    to_submit = ring.sq_local_tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+
+    r = syscall(__NR_io_uring_enter, ring.fd, to_submit, min_complete,
+            min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (r < 0 && errno != EINTR && errno != EBUSY) {
+        ERRNO("io_uring_enter() failed");
+    }
+
+    return r;
+}
+
+void reap() {
+    struct io_uring_cqe *cqe;
+    unsigned int head = *ring.cq_head;
+
+    while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+        cqe = &ring.cqes[head & *ring.cq_mask];
+        uint64_t user_data = cqe->user_data;
+        int res = cqe->res;
+        unsigned int flags = cqe->flags;
+
+        /* release the entry before handling it, as handling may queue new requests */
+        __atomic_store_n(ring.cq_head, ++head, __ATOMIC_RELEASE);
+        handle_cqe(user_data, res, flags);
+    }
+}
+
+void handle_cqe(uint64_t user_data, int res, unsigned int flags) {
+    client_t *client = (client_t *) (uintptr_t) (user_data & ~(uint64_t) TAG_MASK);
+
+    switch (user_data & TAG_MASK) {
+        case TAG_READ:
+            read_posted = 0;
+            read_done = 1;
+            read_result = res;
+            break;
+
+        case TAG_ACCEPT:
+            accept_posted = 0;
+            if (res >= 0) {
+                accept_func(res, &accept_addr);
+                accepted = 1;
+            }
+            else if (res != -EAGAIN && res != -ECANCELED && res != -EINTR) {
+                ERROR("io_uring: accept() failed: %s", strerror(-res));
+            }
+            break;
+
+        case TAG_HEADER:
+            if (res < client->uring_header_len) {
+                client_failed(client, res);
+            }
+            client->uring_inflight--;
+            client_done(client);
+            break;
+
+        case TAG_TIMEOUT:
+            /* fired (rather than being canceled along with a completed send);
+             * the send itself completes as canceled, or short */
+            if (res == -ETIME) {
+                client_failed(client, res);
+            }
+            client->uring_inflight--;
+            client_done(client);
+            break;
+
+        case TAG_DATA:
+            if (flags & IORING_CQE_F_NOTIF) {
+                /* zero-copy send notification, the buffer is no longer used */
+                slot_refs[client->uring_slot]--;
+                client->uring_inflight--;
+                client_done(client);
+                break;
+            }
+
+            if (res < client->uring_len) {
+                client_failed(client, res);
+            }
+            else {
+                client->frames_sent++;
+            }
+
+            if (!(flags & IORING_CQE_F_MORE)) {
+                slot_refs[client->uring_slot]--;
+                client->uring_inflight--;
+                client_done(client);
+            }
+            break;
+    }
+}
+
+
+    /* clients */
+
+void client_failed(client_t *client, int res) {
+    if (client->uring_failed) {
+        return;
+    }
+
+    client->uring_failed = 1;
+    if (res == -ETIME) {
+        ERROR_CLIENT(client, "send() timed out");
+    }
+    else if (res >= 0 || res == -EPIPE || res == -ECONNRESET || res == -ECANCELED) {
+        INFO_CLIENT(client, "connection closed");
+    }
+    else {
+        ERROR_CLIENT(client, "send() failed: %s", strerror(-res));
+    }
+}
+
+void client_done(client_t *client) {
+    if (client->uring_failed && !client->uring_inflight) {
+        cleanup_client(client);
+    }
+}
+
+void abort_client(client_t *client) {
+    struct sockaddr addr;
+
+    /* zero-copy sends hold on to the frame until the peer acknowledges it, which a peer
+     * that stopped reading never does; disconnecting drops the data queued for it,
+     * so that the pending notifications complete */
+    client_failed(client, -ETIME);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sa_family = AF_UNSPEC;
+    if (connect(client->stream_fd, &addr, sizeof(addr)) < 0) {
+        ERRNO_CLIENT(client, "connect() failed");
+    }
+}
+
+int uring_eligible(client_t *client) {
+    /* under load shedding, send loops are measured and throttled in the client threads;
+     * the same goes for the total rate limit, which is only enforced by client threads */
+    return enabled && !client->websocket && !client->rate_limiter.rate && !get_total_rate_limit() && !client->live &&
+            !client->interval && !client->crop && !client->motion_threshold && !client->framing && !client->batch_max &&
+            !load_enabled();
+}
+
+void uring_add_client(client_t *client) {
+    DEBUG_CLIENT(client, "streaming through io_uring");
+
+    if (pthread_mutex_lock(&clients_mutex)) {
+        ERROR("pthread_mutex_lock() failed");
+    }
+
+    client->uring_inflight = 0;
+    client->uring_failed = 0;
+    client->uring = 1;
+
+    if (pthread_mutex_unlock(&clients_mutex)) {
+        ERROR("pthread_mutex_unlock() failed");
+    }
+}
+
+void link_timeout(struct io_uring_sqe *sqe, client_t *client) {
+    /* sockets' send timeouts don't apply to io_uring, so that a peer that stopped reading
+     * would keep its sends in flight forever */
+    sqe->opcode = IORING_OP_LINK_TIMEOUT;
+    sqe->addr = (uintptr_t) &send_timeout;
+    sqe->len = 1;
+    sqe->user_data = (uintptr_t) client | TAG_TIMEOUT;
+}
+
+void queue_client(client_t *client, int slot, int size) {
+    struct io_uring_sqe *header_sqe, *header_timeout_sqe, *data_sqe, *data_timeout_sqe;
+    double now = get_now();
+
+    /* the header and the data are linked, so that they're sent in order,
+     * each followed by its timeout; all the entries must be available at once,
+     * since a chain can't be left half queued */
+    if (sq_space() < 4 && (submit(0) < 0 || sq_space() < 4)) {
+        ERROR_CLIENT(client, "io_uring: submission queue full, skipping frame");
+        return;
+    }
+
+    header_sqe = get_sqe();
+    header_timeout_sqe = get_sqe();
+    data_sqe = get_sqe();
+    data_timeout_sqe = get_sqe();
+    if (!header_sqe || !header_timeout_sqe || !data_sqe || !data_timeout_sqe) {
+        return; /* entries already taken are left as no-ops */
+    }
+
+    client->frame_int = client->frame_int * 0.7 + (now - client->last_frame_time) * 0.3;
+    client->last_frame_time = now;
+
+    /* sends are queued as the frame is published, before its motion analysis is over */
+    client->uring_header_len = format_multipart_header(client->uring_header, MULTIPART_HEADER_LEN, size,
+            motion_score(jpeg_seq));
+    header_sqe->opcode = IORING_OP_SEND;
+    header_sqe->fd = client->stream_fd;
+    header_sqe->addr = (uintptr_t) client->uring_header;
+    header_sqe->len = client->uring_header_len;
+    header_sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL | MSG_MORE;
+    header_sqe->flags = IOSQE_IO_LINK;
+    header_sqe->user_data = (uintptr_t) client | TAG_HEADER;
+
+    link_timeout(header_timeout_sqe, client);
+    header_timeout_sqe->flags = IOSQE_IO_LINK;
+
+    data_sqe->opcode = send_zc ? IORING_OP_SEND_ZC : IORING_OP_SEND;
+    data_sqe->fd = client->stream_fd;
+    data_sqe->addr = (uintptr_t) slots[slot];
+    data_sqe->len = size;
+    data_sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+    data_sqe->flags = IOSQE_IO_LINK;
+    data_sqe->user_data = (uintptr_t) client | TAG_DATA;
+    if (send_zc && fixed_buffers) {
+        data_sqe->ioprio = IORING_RECVSEND_FIXED_BUF;
+        data_sqe->buf_index = slot;
+    }
+
+    link_timeout(data_timeout_sqe, client);
+
+    client->uring_inflight += 4;
+    client->uring_slot = slot;
+    client->uring_len = size;
+    slot_refs[slot]++;
+}
+
+
+    /* input & frames */
+
+int uring_read(int fd, char *buf, int len) {
+    struct io_uring_sqe *sqe;
+
+    /* the buffer must stay the same across interrupted calls */
+    if (!read_posted && !read_done) {
+        sqe = get_sqe();
+        if (!sqe) {
+            return -1;
+        }
+
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = fd;
+        sqe->addr = (uintptr_t) buf;
+        sqe->len = len;
+        sqe->off = (uint64_t) -1; /* current position */
+        sqe->user_data = TAG_READ;
+        read_posted = 1;
+    }
+
+    while (!read_done) {
+        if (submit(1) < 0) {
+            return -1;
+        }
+
+        reap();
+
+        if (accepted && !read_done) {
+            /* let the caller know about the new client, the read stays posted */
+            accepted = 0;
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    read_done = 0;
+    accepted = 0;
+    if (read_result < 0) {
+        errno = -read_result;
+        return -1;
+    }
+
+    return read_result;
+}
+
+void uring_arm_accept(int socket_fd) {
+    struct io_uring_sqe *sqe;
+
+    if (accept_posted) {
+        return;
+    }
+
+    sqe = get_sqe();
+    if (!sqe) {
+        return;
+    }
+
+    accept_addr_len = sizeof(accept_addr);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = socket_fd;
+    sqe->addr = (uintptr_t) &accept_addr;
+    sqe->addr2 = (uintptr_t) &accept_addr_len;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = TAG_ACCEPT;
+    accept_posted = 1;
+}
+
+void uring_send_frame(char *buf, int size) {
+    client_t *client;
+    double now = get_now();
+    int i, slot = -1, busy = 0;
+
+    if (!enabled) {
+        return;
+    }
+
+    /* pick a buffer that's not used by sends still in flight, other than the last one */
+    for (i = 1; i <= URING_SLOTS; i++) {
+        busy += slot_refs[i - 1] > 0;
+        if (slot < 0 && !slot_refs[(last_slot + i) % URING_SLOTS]) {
+            slot = (last_slot + i) % URING_SLOTS;
+        }
+    }
+
+    /* frame buffers only grow when none of them is in use */
+    if (size > slot_len && !busy && alloc_slots(size) < 0) {
+        ERROR("io_uring: failed to allocate frame buffers");
+    }
+
+    if (slot < 0 || size > slot_len) {
+        DEBUG("io_uring: no free frame buffer, skipping frame");
+        reap();
+        return;
+    }
+
+    memcpy(slots[slot], buf, size);
+    last_slot = slot;
+
+    if (pthread_mutex_lock(&clients_mutex)) {
+        ERROR("pthread_mutex_lock() failed");
+        return;
+    }
+
+    for (i = 0; i < num_clients; i++) {
+        client = clients[i];
+        if (client->uring && client->uring_inflight && !client->uring_failed &&
+                now - client->last_frame_time > send_timeout.tv_sec) {
+            abort_client(client);
+        }
+
+        if (!client->uring || client->uring_inflight || client->uring_failed || client->parked) {
+            continue; /* clients still busy with a previous frame get the next one */
+        }
+
+        queue_client(client, slot, size);
+    }
+
+    if (pthread_mutex_unlock(&clients_mutex)) {
+        ERROR("pthread_mutex_unlock() failed");
+    }
+
+    /* a single submission for all the clients */
+    submit(0);
+    reap();
+}
+
+
+    /* hand-off & shutdown */
+
+void uring_park(double timeout) {
+    struct __kernel_timespec ts = {0, 100000000}; /* 100 ms */
+    struct io_uring_sqe *sqe;
+    double start = get_now();
+    int i, busy;
+
+    if (!enabled) {
+        return;
+    }
+
+    /* the listening socket is about to be passed on */
+    if (accept_posted && (sqe = get_sqe())) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = TAG_ACCEPT;
+        sqe->user_data = TAG_INTERNAL;
+    }
+
+    /* wait for the sends in flight, so that clients are parked at a frame boundary */
+    while (1) {
+        pthread_mutex_lock(&clients_mutex);
+        for (i = 0, busy = accept_posted; i < num_clients; i++) {
+            busy += clients[i]->uring && clients[i]->uring_inflight;
+        }
+        pthread_mutex_unlock(&clients_mutex);
+
+        if (!busy || get_now() - start > timeout) {
+            break;
+        }
+
+        if ((sqe = get_sqe())) {
+            sqe->opcode = IORING_OP_TIMEOUT;
+            sqe->addr = (uintptr_t) &ts;
+            sqe->len = 1;
+            sqe->user_data = TAG_INTERNAL;
+        }
+        submit(1);
+        reap();
+    }
+
+    pthread_mutex_lock(&clients_mutex);
+    for (i = 0; i < num_clients; i++) {
+        if (clients[i]->uring && !clients[i]->uring_inflight && !clients[i]->uring_failed) {
+            clients[i]->parked = 1;
+        }
+    }
+    pthread_mutex_unlock(&clients_mutex);
+}
+
+void uring_stop() {
+    client_t **owned = NULL;
+    int num_owned = 0, i;
+
+    if (!ring_open) {
+        return;
+    }
+
+    enabled = 0;
+
+    /* closing the ring cancels whatever is still in flight */
+    close(ring.fd);
+    ring_open = 0;
+
+    pthread_mutex_lock(&clients_mutex);
+    for (i = 0; i < num_clients; i++) {
+        if (clients[i]->uring) {
+            owned = realloc(owned, sizeof(client_t *) * (num_owned + 1));
+            owned[num_owned++] = clients[i];
+        }
+    }
+    pthread_mutex_unlock(&clients_mutex);
+
+    for (i = 0; i < num_owned; i++) {
+        cleanup_client(owned[i]);
+    }
+
+    free(owned);
+}
+
+
+#else /* HAVE_IO_URING */
+
+
+int uring_init(int timeout, void (*func)(int fd, struct sockaddr_in *addr)) {
+    ERROR("io_uring: not supported by this build");
+    return -1;
+}
+
+int uring_enabled() {
+    return 0;
+}
+
+int uring_read(int fd, char *buf, int len) {
+    return read(fd, buf, len);
+}
+
+void uring_arm_accept(int socket_fd) {
+}
+
+int uring_eligible(client_t *client) {
+    return 0;
+}
+
+void uring_add_client(client_t *client) {
+}
+
+void uring_send_frame(char *buf, int size) {
+}
+
+void uring_park(double timeout) {
+}
+
+void uring_stop() {
+}
+
+
+#endif /* HAVE_IO_URING */
@@ -0,0 +1,43 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __URING_H
+#define __URING_H
+
+#include <netinet/in.h>
+
+#include "client.h"
+
+#define URING_ENTRIES           256
+#define URING_SLOTS             3 /* registered frame buffers */
+#define URING_MIN_SLOT_LEN      1024 * 1024 /* 1MB */
+
+
+int                 uring_init(int timeout, void (*accept_func)(int fd, struct sockaddr_in *addr));
+int                 uring_enabled();
+int                 uring_read(int fd, char *buf, int len);
+void                uring_arm_accept(int socket_fd);
+int                 uring_eligible(client_t *client);
+void                uring_add_client(client_t *client);
+void                uring_send_frame(char *buf, int size);
+void                uring_park(double timeout);
+void                uring_stop();
+
+
+#endif /* __URING_H */
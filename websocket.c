@@ -0,0 +1,334 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <arpa/inet.h>
+
+#include "streameye.h"
+#include "common.h"
+#include "auth.h"
+#include "websocket.h"
+
+
+#define WS_GUID                 "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+
+const char *RESPONSE_WEBSOCKET_HEADER_TEMPLATE =
+        "HTTP/1.1 101 Switching Protocols\r\n"
+        "Server: streamEye/%s\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: %s\r\n"
+        "\r\n";
+
+
+    /* locals */
+
+static int max_unacked = DEF_WS_MAX_UNACKED;
+
+
+    /* local functions */
+
+static void         sha1(const unsigned char *data, int len, unsigned char *digest);
+static int          write_control_frame(client_t *client, int opcode, char *payload, int len);
+static void         handle_ack(client_t *client, unsigned int seq);
+
+
+void set_websocket_max_unacked(int value) {
+    max_unacked = MAX(1, MIN(value, WS_MAX_UNACKED_LIMIT));
+}
+
+int get_websocket_max_unacked() {
+    return max_unacked;
+}
+
+
+    /* sha1 */
+
+#define ROL(x, n)               (((x) << (n)) | ((x) >> (32 - (n))))
+
+void sha1(const unsigned char *data, int len, unsigned char *digest) {
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    uint32_t w[80], a, b, c, d, e, f, k, t;
+    unsigned char block[64];
+    uint64_t bit_len = (uint64_t) len * 8;
+    int i, offs, block_len, padded = 0, done = 0;
+
+    for (offs = 0; !done; offs += 64) {
+        block_len = MAX(0, MIN(64, len - offs));
+        memset(block, 0, 64);
+        memcpy(block, data + offs, block_len);
+
+        if (block_len < 64 && !padded) {
+            block[block_len] = 0x80;
+            padded = 1;
+        }
+        if (padded && block_len < 56) {
+            for (i = 0; i < 8; i++) {
+                block[63 - i] = bit_len >> (8 * i);
+            }
+            done = 1;
+        }
+
+        for (i = 0; i < 16; i++) {
+            w[i] = block[i * 4] << 24 | block[i * 4 + 1] << 16 | block[i * 4 + 2] << 8 | block[i * 4 + 3];
+        }
+        for (i = 16; i < 80; i++) {
+            w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+
+        a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+        for (i = 0; i < 80; i++) {
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            }
+            else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            }
+            else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            }
+            else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+
+            t = ROL(a, 5) + f + e + k + w[i];
+            e = d; d = c; c = ROL(b, 30); b = a; a = t;
+        }
+
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+
+    for (i = 0; i < 20; i++) {
+        digest[i] = h[i / 4] >> (24 - 8 * (i % 4));
+    }
+}
+
+
+    /* websocket protocol */
+
+int websocket_write_handshake(client_t *client) {
+    char key_guid[sizeof(client->ws_key) + sizeof(WS_GUID)];
+    unsigned char digest[20];
+    char accept[BASE64_LENGTH(20) + 1];
+
+    snprintf(key_guid, sizeof(key_guid), "%s%s", client->ws_key, WS_GUID);
+    sha1((unsigned char *) key_guid, strlen(key_guid), digest);
+    base64_encode((char *) digest, accept, 20);
+
+    char *data = malloc(strlen(RESPONSE_WEBSOCKET_HEADER_TEMPLATE) + 16 + strlen(accept));
+    sprintf(data, RESPONSE_WEBSOCKET_HEADER_TEMPLATE, STREAM_EYE_VERSION, accept);
+
+    int r = write_to_client(client, data, strlen(data));
+    free(data);
+
+    return r;
+}
+
+int write_control_frame(client_t *client, int opcode, char *payload, int len) {
+    char buf[2 + 125];
+
+    len = MIN(len, 125);
+    buf[0] = 0x80 | opcode;
+    buf[1] = len;
+    memcpy(buf + 2, payload, len);
+
+    return write_to_client(client, buf, 2 + len);
+}
+
+void handle_ack(client_t *client, unsigned int seq) {
+    int i, j;
+
+    /* acknowledgements are cumulative: everything up to (and including)
+     * the given sequence number has been rendered by the client */
+    for (i = 0; i < client->ws_unacked; i++) {
+        if ((int) (client->ws_unacked_seq[i] - seq) > 0) {
+            break;
+        }
+    }
+
+    for (j = i; j < client->ws_unacked; j++) {
+        client->ws_unacked_seq[j - i] = client->ws_unacked_seq[j];
+    }
+
+    client->ws_unacked -= i;
+    DEBUG_CLIENT(client, "websocket ack for frame %u, %d frames in flight", seq, client->ws_unacked);
+}
+
+int websocket_read_messages(client_t *client) {
+    unsigned char *buf = (unsigned char *) client->ws_rbuf;
+    unsigned char mask[4];
+    char payload[WS_RBUF_LEN];
+    int size, opcode, masked, header_len, i;
+    uint64_t len;
+    unsigned int seq;
+
+    /* never block here, acks are consumed whenever there's a new frame to send */
+    while (1) {
+        size = recv(client->stream_fd, client->ws_rbuf + client->ws_rbuf_len,
+                WS_RBUF_LEN - client->ws_rbuf_len, MSG_DONTWAIT);
+        if (size < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                break;
+            }
+
+            ERRNO_CLIENT(client, "recv() failed");
+            return -1;
+        }
+        else if (size == 0) {
+            return 0;
+        }
+
+        client->ws_rbuf_len += size;
+
+        /* parse all the complete messages we have */
+        while (client->ws_rbuf_len >= 2) {
+            opcode = buf[0] & 0x0F;
+            masked = buf[1] & 0x80;
+            len = buf[1] & 0x7F;
+            header_len = 2;
+
+            if (len == 126) {
+                if (client->ws_rbuf_len < 4) {
+                    break;
+                }
+                len = buf[2] << 8 | buf[3];
+                header_len = 4;
+            }
+            else if (len == 127) {
+                ERROR_CLIENT(client, "websocket message too large");
+                return -1;
+            }
+
+            if (!masked) {
+                ERROR_CLIENT(client, "unmasked websocket message");
+                return -1;
+            }
+
+            if (header_len + 4 + len > WS_RBUF_LEN) {
+                ERROR_CLIENT(client, "websocket message too large");
+                return -1;
+            }
+            if (header_len + 4 + len > client->ws_rbuf_len) {
+                break; /* incomplete message */
+            }
+
+            memcpy(mask, buf + header_len, 4);
+            for (i = 0; i < len; i++) {
+                payload[i] = buf[header_len + 4 + i] ^ mask[i % 4];
+            }
+
+            switch (opcode) {
+                case WS_OPCODE_TEXT:
+                    payload[len] = 0;
+                    handle_ack(client, strtoul(payload, NULL, 10));
+                    break;
+
+                case WS_OPCODE_BINARY:
+                    if (len >= 4) {
+                        seq = (unsigned char) payload[0] << 24 | (unsigned char) payload[1] << 16 |
+                                (unsigned char) payload[2] << 8 | (unsigned char) payload[3];
+                        handle_ack(client, seq);
+                    }
+                    break;
+
+                case WS_OPCODE_PING:
+                    if (write_control_frame(client, WS_OPCODE_PONG, payload, len) < 0) {
+                        return -1;
+                    }
+                    break;
+
+                case WS_OPCODE_CLOSE:
+                    DEBUG_CLIENT(client, "websocket close received");
+                    write_control_frame(client, WS_OPCODE_CLOSE, payload, MIN(len, 2));
+                    return 0;
+
+                default: /* pong, continuation */
+                    break;
+            }
+
+            client->ws_rbuf_len -= header_len + 4 + len;
+            memmove(client->ws_rbuf, client->ws_rbuf + header_len + 4 + len, client->ws_rbuf_len);
+        }
+    }
+
+    return 1;
+}
+
+int websocket_can_send(client_t *client) {
+    return client->ws_unacked < max_unacked;
+}
+
+int websocket_write_frame(client_t *client) {
+    unsigned char header[10 + WS_FRAME_HEADER_LEN];
+    uint64_t len = WS_FRAME_HEADER_LEN + client->jpeg_tmp_buf_size;
+    uint64_t timestamp = client->jpeg_tmp_timestamp * 1000;
+    int header_len, i;
+
+    header[0] = 0x80 | WS_OPCODE_BINARY;
+    if (len < 126) {
+        header[1] = len;
+        header_len = 2;
+    }
+    else if (len < 65536) {
+        header[1] = 126;
+        header[2] = len >> 8;
+        header[3] = len;
+        header_len = 4;
+    }
+    else {
+        header[1] = 127;
+        for (i = 0; i < 8; i++) {
+            header[2 + i] = len >> (56 - 8 * i);
+        }
+        header_len = 10;
+    }
+
+    for (i = 0; i < 4; i++) {
+        header[header_len++] = client->jpeg_tmp_seq >> (24 - 8 * i);
+    }
+    for (i = 0; i < 8; i++) {
+        header[header_len++] = timestamp >> (56 - 8 * i);
+    }
+
+    int written = write_to_client(client, (char *) header, header_len);
+    if (written <= 0) {
+        return written;
+    }
+
+    written = write_frame_data_to_client(client);
+    if (written <= 0) {
+        return written;
+    }
+
+    client->ws_unacked_seq[client->ws_unacked++] = client->jpeg_tmp_seq;
+
+    return written;
+}
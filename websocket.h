@@ -0,0 +1,49 @@
+
+/*
+ * Copyright (c) Calin Crisan
+ * This file is part of streamEye.
+ *
+ * streamEye is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __WEBSOCKET_H
+#define __WEBSOCKET_H
+
+#include "client.h"
+
+#define DEF_WS_MAX_UNACKED      2
+
+#define WS_OPCODE_CONT          0x0
+#define WS_OPCODE_TEXT          0x1
+#define WS_OPCODE_BINARY        0x2
+#define WS_OPCODE_CLOSE         0x8
+#define WS_OPCODE_PING          0x9
+#define WS_OPCODE_PONG          0xA
+
+/* every binary frame message starts with a 12 bytes header:
+ * the frame sequence number (4 bytes) and the frame timestamp,
+ * in milliseconds since the epoch (8 bytes), both big endian */
+#define WS_FRAME_HEADER_LEN     12
+
+
+void                set_websocket_max_unacked(int max_unacked);
+int                 get_websocket_max_unacked();
+
+int                 websocket_write_handshake(client_t *client);
+int                 websocket_read_messages(client_t *client);
+int                 websocket_can_send(client_t *client);
+int                 websocket_write_frame(client_t *client);
+
+
+#endif /* __WEBSOCKET_H */